@@ -0,0 +1,898 @@
+// Copyright 2024 SM6WJM
+
+#include "Aggregate.hpp"
+
+#include <SoapySDR/ConverterRegistry.hpp>
+#include <SoapySDR/Formats.hpp>
+#include <SoapySDR/Logger.hpp>
+#include <SoapySDR/Time.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <future>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include <fmt/core.h>
+
+// Child streams of an aggregate stream, one per channel.
+struct SoapyAirspyHFAggregate::Stream {
+  std::vector<size_t> channels;
+  std::vector<SoapySDR::Stream *> streams;
+  size_t elemSize = 0;
+  size_t mtu = 0;
+  std::atomic<double> rate{0};
+  // From the stream format to CF32 for the cross-correlation, null if the
+  // format is CF32 already or there is no converter.
+  SoapySDR::ConverterRegistry::ConverterFunction toCF32 = nullptr;
+  bool correlate = false;
+  // Samples read but not returned after a partial read, per channel, and
+  // the time of the first one of channel 0.
+  std::vector<std::vector<char>> carry;
+  long long carryTimeNs = 0;
+  // Time of the next sample of each channel, in its own time base. A
+  // read starting elsewhere lost samples on that receiver.
+  std::vector<long long> nextNs;
+  std::atomic<bool> realign{false};
+};
+
+namespace {
+
+using Samples = std::vector<std::complex<float>>;
+
+// Next sample time not known yet, after alignment started.
+constexpr long long unknown_ns = std::numeric_limits<long long>::min();
+
+// Whether count samples at timeNs follow the last read of channel, and
+// move nextNs past them. A receiver that lost samples only moves its
+// timestamps, it doesn't return an overflow.
+bool follows(long long &nextNs, const size_t channel, const long long timeNs,
+             const int count, const double rate) {
+  const long long gapNs = nextNs == unknown_ns ? 0 : timeNs - nextNs;
+  nextNs = timeNs + SoapySDR::ticksToTimeNs(count, rate);
+  // Half a sample either way is rounding.
+  if (static_cast<double>(std::llabs(gapNs)) * rate < 0.5e9) {
+    return true;
+  }
+  SoapySDR::logf(SOAPY_SDR_WARNING,
+                 "Aggregate: channel %zu jumped %lld ns, realigning", channel,
+                 gapNs);
+  return false;
+}
+
+// Lag of x against reference within max_lag, x[i + lag] matches
+// reference[i], and the normalised correlation at it.
+std::pair<long, double> correlate(const Samples &reference, const Samples &x,
+                                  const long maxLag) {
+  const auto length = static_cast<long>(reference.size()) - 2 * maxLag;
+
+  // Energy of x windows by prefix sums
+  std::vector<double> energy(x.size() + 1, 0);
+  for (size_t i = 0; i < x.size(); i++) {
+    energy[i + 1] = energy[i] + std::norm(x[i]);
+  }
+  double referenceEnergy = 0;
+  for (long i = 0; i < length; i++) {
+    referenceEnergy +=
+        std::norm(reference[static_cast<size_t>(maxLag + i)]);
+  }
+
+  long best = 0;
+  double peak = 0;
+  for (long lag = -maxLag; lag <= maxLag; lag++) {
+    std::complex<double> sum = 0;
+    const auto *r = &reference[static_cast<size_t>(maxLag)];
+    const auto *s = &x[static_cast<size_t>(maxLag + lag)];
+    for (long i = 0; i < length; i++) {
+      sum += std::complex<double>(r[i] * std::conj(s[i]));
+    }
+    const auto begin = static_cast<size_t>(maxLag + lag);
+    const double xEnergy =
+        energy[begin + static_cast<size_t>(length)] - energy[begin];
+    const double norm = std::sqrt(referenceEnergy * xEnergy);
+    const double value = norm > 0 ? std::abs(sum) / norm : 0;
+    if (value > peak) {
+      peak = value;
+      best = lag;
+    }
+  }
+  return {best, peak};
+}
+
+std::vector<std::string> split(const std::string &list) {
+  std::vector<std::string> parts;
+  std::stringstream stream(list);
+  std::string part;
+  while (std::getline(stream, part, SoapyAirspyHFAggregate::serial_separator)) {
+    parts.push_back(part);
+  }
+  return parts;
+}
+
+} // namespace
+
+SoapyAirspyHFAggregate::SoapyAirspyHFAggregate(const SoapySDR::Kwargs &args)
+    : serials_(split(args.at("serial"))) {
+
+  // Every receiver gets the device args, except those that can only be
+  // served once.
+  auto receiverArgs = args;
+  for (const auto &key : {"export", "rtltcp"}) {
+    if (receiverArgs.erase(key)) {
+      SoapySDR::logf(SOAPY_SDR_WARNING,
+                     "Aggregate device: %s not supported, ignored", key);
+    }
+  }
+
+  // Open in parallel, opening takes a while. Wait for all before throwing
+  // so none is left behind.
+  std::vector<std::future<std::unique_ptr<SoapyAirspyHF>>> opening;
+  for (const auto &serial : serials_) {
+    receiverArgs["serial"] = serial;
+    opening.push_back(std::async(std::launch::async, [receiverArgs] {
+      return std::make_unique<SoapyAirspyHF>(receiverArgs);
+    }));
+  }
+  std::exception_ptr error;
+  for (auto &receiver : opening) {
+    try {
+      receivers_.push_back(receiver.get());
+    } catch (...) {
+      error = std::current_exception();
+    }
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+
+  SoapySDR::logf(SOAPY_SDR_INFO, "Aggregate device with %zu receivers",
+                 receivers_.size());
+}
+
+// Out of line, Stream is only complete here.
+SoapyAirspyHFAggregate::~SoapyAirspyHFAggregate(void) = default;
+
+SoapyAirspyHF &SoapyAirspyHFAggregate::receiver(const size_t channel) const {
+  if (channel >= receivers_.size()) {
+    throw std::runtime_error("Aggregate device: no channel " +
+                             std::to_string(channel));
+  }
+  return *receivers_[channel];
+}
+
+/*******************************************************************
+ * Identification API
+ ******************************************************************/
+
+std::string SoapyAirspyHFAggregate::getDriverKey(void) const {
+  return "AirspyHF";
+}
+
+std::string SoapyAirspyHFAggregate::getHardwareKey(void) const {
+  return "AirspyHF aggregate";
+}
+
+SoapySDR::Kwargs SoapyAirspyHFAggregate::getHardwareInfo(void) const {
+  SoapySDR::Kwargs args;
+  for (size_t channel = 0; channel < receivers_.size(); channel++) {
+    for (const auto &[key, value] : receivers_[channel]->getHardwareInfo()) {
+      args[fmt::format("{}_{}", key, channel)] = value;
+    }
+  }
+  return args;
+}
+
+/*******************************************************************
+ * Channels API
+ ******************************************************************/
+
+size_t SoapyAirspyHFAggregate::getNumChannels(const int direction) const {
+  return direction == SOAPY_SDR_RX ? receivers_.size() : 0;
+}
+
+/*******************************************************************
+ * Stream API
+ ******************************************************************/
+
+std::vector<std::string>
+SoapyAirspyHFAggregate::getStreamFormats(const int direction,
+                                         const size_t channel) const {
+  return receiver(channel).getStreamFormats(direction, 0);
+}
+
+std::string SoapyAirspyHFAggregate::getNativeStreamFormat(
+    const int direction, const size_t channel, double &fullScale) const {
+  return receiver(channel).getNativeStreamFormat(direction, 0, fullScale);
+}
+
+SoapySDR::ArgInfoList
+SoapyAirspyHFAggregate::getStreamArgsInfo(const int direction,
+                                          const size_t channel) const {
+  return receiver(channel).getStreamArgsInfo(direction, 0);
+}
+
+SoapySDR::Stream *
+SoapyAirspyHFAggregate::setupStream(const int direction,
+                                    const std::string &format,
+                                    const std::vector<size_t> &channels,
+                                    const SoapySDR::Kwargs &args) {
+
+  SoapySDR::logf(SOAPY_SDR_DEBUG, "Aggregate setupStream(%d, %s, %zu)",
+                 direction, format.c_str(), channels.size());
+
+  auto stream = std::make_unique<Stream>();
+  stream->channels = channels.empty() ? std::vector<size_t>{0} : channels;
+
+  // Each receiver dropping its own samples would undo the alignment.
+  if (args.count("settle") and args.at("settle") == "discard") {
+    throw std::runtime_error("setupStream settle=discard not supported by "
+                             "aggregate devices, use mark.");
+  }
+
+  stream->rate = receiver(stream->channels.front()).getSampleRate(direction, 0);
+  for (const auto channel : stream->channels) {
+    if (receiver(channel).getSampleRate(direction, 0) != stream->rate) {
+      throw std::runtime_error("setupStream channels at different rates.");
+    }
+  }
+
+  try {
+    for (const auto channel : stream->channels) {
+      stream->streams.push_back(
+          receiver(channel).setupStream(direction, format, {0}, args));
+    }
+  } catch (...) {
+    for (size_t i = 0; i < stream->streams.size(); i++) {
+      receiver(stream->channels[i]).closeStream(stream->streams[i]);
+    }
+    throw;
+  }
+
+  stream->elemSize = SoapySDR::formatToSize(format);
+  stream->mtu = receiver(stream->channels.front())
+                    .getStreamMTU(stream->streams.front());
+  stream->carry.resize(stream->channels.size());
+  stream->nextNs.resize(stream->channels.size(), unknown_ns);
+
+  stream->correlate = format == SOAPY_SDR_CF32;
+  if (format != SOAPY_SDR_CF32) {
+    const auto targets = SoapySDR::ConverterRegistry::listTargetFormats(format);
+    if (std::find(targets.begin(), targets.end(), SOAPY_SDR_CF32) !=
+        targets.end()) {
+      stream->toCF32 =
+          SoapySDR::ConverterRegistry::getFunction(format, SOAPY_SDR_CF32);
+      stream->correlate = true;
+    } else if (stream->channels.size() > 1) {
+      SoapySDR::logf(SOAPY_SDR_WARNING,
+                     "setupStream: no %s to CF32 converter, channels are "
+                     "aligned by host clock only",
+                     format.c_str());
+    }
+  }
+
+  std::unique_lock<std::mutex> lock(streamsLock_);
+  streams_.push_back(std::move(stream));
+  return reinterpret_cast<SoapySDR::Stream *>(streams_.back().get());
+}
+
+void SoapyAirspyHFAggregate::closeStream(SoapySDR::Stream *stream) {
+  // Check that stream belongs to us before touching it
+  std::unique_ptr<Stream> aggregate;
+  {
+    std::unique_lock<std::mutex> lock(streamsLock_);
+    const auto it = std::find_if(
+        streams_.begin(), streams_.end(), [stream](const auto &candidate) {
+          return reinterpret_cast<SoapySDR::Stream *>(candidate.get()) ==
+                 stream;
+        });
+    if (it == streams_.end()) {
+      SoapySDR::logf(SOAPY_SDR_ERROR, "Aggregate closeStream: invalid stream");
+      return;
+    }
+    aggregate = std::move(*it);
+    streams_.erase(it);
+  }
+
+  for (size_t i = 0; i < aggregate->streams.size(); i++) {
+    receiver(aggregate->channels[i]).closeStream(aggregate->streams[i]);
+  }
+}
+
+size_t SoapyAirspyHFAggregate::getStreamMTU(SoapySDR::Stream *stream) const {
+  return reinterpret_cast<Stream *>(stream)->mtu;
+}
+
+int SoapyAirspyHFAggregate::activateStream(SoapySDR::Stream *stream,
+                                           const int flags,
+                                           const long long timeNs,
+                                           const size_t numElems) {
+  auto &aggregate = *reinterpret_cast<Stream *>(stream);
+
+  for (size_t i = 0; i < aggregate.streams.size(); i++) {
+    const int ret = receiver(aggregate.channels[i])
+                        .activateStream(aggregate.streams[i], flags, timeNs,
+                                        numElems);
+    if (ret != 0) {
+      for (size_t j = 0; j < i; j++) {
+        receiver(aggregate.channels[j]).deactivateStream(aggregate.streams[j]);
+      }
+      return ret;
+    }
+  }
+
+  // Aligned by the first readStream, in the reading thread.
+  for (auto &carry : aggregate.carry) {
+    carry.clear();
+  }
+  aggregate.realign = true;
+  return 0;
+}
+
+int SoapyAirspyHFAggregate::deactivateStream(SoapySDR::Stream *stream,
+                                             const int flags,
+                                             const long long timeNs) {
+  auto &aggregate = *reinterpret_cast<Stream *>(stream);
+
+  int result = 0;
+  for (size_t i = 0; i < aggregate.streams.size(); i++) {
+    const int ret = receiver(aggregate.channels[i])
+                        .deactivateStream(aggregate.streams[i], flags, timeNs);
+    if (ret != 0) {
+      result = ret;
+    }
+  }
+  return result;
+}
+
+int SoapyAirspyHFAggregate::align(Stream &stream, const long timeoutUs) {
+  const size_t channels = stream.channels.size();
+  for (auto &carry : stream.carry) {
+    carry.clear();
+  }
+  std::fill(stream.nextNs.begin(), stream.nextNs.end(), unknown_ns);
+  if (channels < 2) {
+    return 0;
+  }
+
+  std::vector<char> scratch(std::max(stream.mtu, reference_samples) *
+                            stream.elemSize);
+
+  // Exactly count samples of the channel at index i, and the time of the
+  // first.
+  const auto read = [&](const size_t i, void *buff, const size_t count,
+                        long long &firstNs) {
+    size_t done = 0;
+    while (done < count) {
+      void *buffs[] = {static_cast<char *>(buff) + done * stream.elemSize};
+      int flags = 0;
+      long long timeNs = 0;
+      const int ret = receiver(stream.channels[i])
+                          .readStream(stream.streams[i], buffs, count - done,
+                                      flags, timeNs, timeoutUs);
+      if (ret < 0) {
+        return ret;
+      }
+      // Samples lost while aligning, start over.
+      if (not follows(stream.nextNs[i], stream.channels[i], timeNs, ret,
+                      stream.rate)) {
+        return SOAPY_SDR_OVERFLOW;
+      }
+      if (done == 0) {
+        firstNs = timeNs;
+      }
+      done += static_cast<size_t>(ret);
+    }
+    return 0;
+  };
+  const auto skip = [&](const size_t i, size_t count) {
+    long long unused = 0;
+    while (count > 0) {
+      const size_t chunk = std::min(count, reference_samples);
+      const int ret = read(i, scratch.data(), chunk, unused);
+      if (ret < 0) {
+        return ret;
+      }
+      count -= chunk;
+    }
+    return 0;
+  };
+
+  // Host clock: read a while so the transfer timing settles, then drop
+  // samples of the channels that started earlier.
+  std::vector<long long> nextNs(channels);
+  for (size_t i = 0; i < channels; i++) {
+    long long firstNs = 0;
+    const int ret = read(i, scratch.data(), reference_samples, firstNs);
+    if (ret < 0) {
+      return ret;
+    }
+    nextNs[i] = receiver(stream.channels[i]).hostTimeNs(firstNs) +
+                SoapySDR::ticksToTimeNs(
+                    static_cast<long long>(reference_samples), stream.rate);
+  }
+  const long long latestNs = *std::max_element(nextNs.begin(), nextNs.end());
+  std::vector<size_t> skipped(channels);
+  for (size_t i = 0; i < channels; i++) {
+    skipped[i] = static_cast<size_t>(
+        std::llround(static_cast<double>(latestNs - nextNs[i]) * 1e-9 *
+                     stream.rate));
+    const int ret = skip(i, skipped[i]);
+    if (ret < 0) {
+      return ret;
+    }
+  }
+
+  // Common reference: lag of each channel against channel 0, then drop
+  // samples so that all match the latest one.
+  std::vector<long> lags(channels, 0);
+  std::vector<double> peaks(channels, 1.0);
+  size_t drained = 0;
+  if (stream.correlate) {
+    std::vector<Samples> blocks(channels, Samples(reference_samples));
+    for (size_t i = 0; i < channels; i++) {
+      long long unused = 0;
+      void *buff = stream.toCF32 ? static_cast<void *>(scratch.data())
+                                 : static_cast<void *>(blocks[i].data());
+      const int ret = read(i, buff, reference_samples, unused);
+      if (ret < 0) {
+        return ret;
+      }
+      if (stream.toCF32) {
+        stream.toCF32(scratch.data(), blocks[i].data(), reference_samples,
+                      1.0);
+      }
+    }
+
+    // The correlation takes longer than the rings of the receivers last.
+    // Run it on its own thread, and meanwhile read and drop the same
+    // number of samples of every channel, which keeps their alignment.
+    auto correlating = std::async(std::launch::async, [&blocks] {
+      std::vector<std::pair<long, double>> results(blocks.size(), {0, 1.0});
+      for (size_t i = 1; i < blocks.size(); i++) {
+        results[i] =
+            correlate(blocks[0], blocks[i], static_cast<long>(max_lag));
+      }
+      return results;
+    });
+    while (correlating.wait_for(std::chrono::seconds(0)) !=
+           std::future_status::ready) {
+      for (size_t i = 0; i < channels; i++) {
+        // The future waits for the correlation before blocks go away.
+        const int ret = skip(i, stream.mtu);
+        if (ret < 0) {
+          return ret;
+        }
+      }
+      drained += stream.mtu;
+    }
+    const auto results = correlating.get();
+
+    for (size_t i = 1; i < channels; i++) {
+      const auto [lag, peak] = results[i];
+      peaks[i] = peak;
+      if (peak >= min_correlation) {
+        lags[i] = lag;
+      } else {
+        SoapySDR::logf(SOAPY_SDR_WARNING,
+                       "Aggregate align: no common signal on channel %zu "
+                       "(%.2f), aligned by host clock only",
+                       stream.channels[i], peak);
+      }
+    }
+  }
+  const long earliest = *std::min_element(lags.begin(), lags.end());
+  for (size_t i = 0; i < channels; i++) {
+    const auto shift = static_cast<size_t>(lags[i] - earliest);
+    const int ret = skip(i, shift);
+    if (ret < 0) {
+      return ret;
+    }
+    skipped[i] += shift;
+  }
+
+  std::string alignment;
+  for (size_t i = 0; i < channels; i++) {
+    alignment += fmt::format("{}{}={}/{:.2f}", i > 0 ? "," : "",
+                             stream.channels[i], skipped[i], peaks[i]);
+  }
+  SoapySDR::logf(SOAPY_SDR_INFO,
+                 "Aggregate aligned: %s, %zu samples drained meanwhile",
+                 alignment.c_str(), drained);
+
+  std::unique_lock<std::mutex> lock(streamsLock_);
+  alignment_ = alignment;
+  return 0;
+}
+
+int SoapyAirspyHFAggregate::readStream(SoapySDR::Stream *stream,
+                                       void *const *buffs,
+                                       const size_t numElems, int &flags,
+                                       long long &timeNs,
+                                       const long timeoutUs) {
+  auto &aggregate = *reinterpret_cast<Stream *>(stream);
+  const size_t elemSize = aggregate.elemSize;
+
+  if (aggregate.realign.exchange(false)) {
+    const int ret = align(aggregate, timeoutUs);
+    if (ret < 0) {
+      aggregate.realign = true;
+      return ret;
+    }
+  }
+
+  flags = 0;
+  timeNs = 0;
+  const size_t count = std::min(numElems, aggregate.mtu);
+
+  for (size_t i = 0; i < aggregate.streams.size(); i++) {
+    auto *buff = static_cast<char *>(buffs[i]);
+    auto &carry = aggregate.carry[i];
+
+    // Left over from a partial read first
+    size_t done = std::min(carry.size() / elemSize, count);
+    if (done > 0) {
+      std::memcpy(buff, carry.data(), done * elemSize);
+      carry.erase(carry.begin(),
+                  carry.begin() + static_cast<std::ptrdiff_t>(done * elemSize));
+      if (i == 0) {
+        timeNs = aggregate.carryTimeNs;
+        aggregate.carryTimeNs += SoapySDR::ticksToTimeNs(
+            static_cast<long long>(done), aggregate.rate);
+      }
+    }
+
+    while (done < count) {
+      void *childBuffs[] = {buff + done * elemSize};
+      int childFlags = 0;
+      long long childTimeNs = 0;
+      const int ret = receiver(aggregate.channels[i])
+                          .readStream(aggregate.streams[i], childBuffs,
+                                      count - done, childFlags, childTimeNs,
+                                      timeoutUs);
+
+      // Lost samples on one channel, line them up again.
+      if (ret == SOAPY_SDR_OVERFLOW or
+          (ret >= 0 and not follows(aggregate.nextNs[i], aggregate.channels[i],
+                                    childTimeNs, ret, aggregate.rate))) {
+        for (auto &entry : aggregate.carry) {
+          entry.clear();
+        }
+        aggregate.realign = true;
+        return SOAPY_SDR_OVERFLOW;
+      }
+
+      // Keep what was read for the next call, in front of what's left.
+      if (ret < 0) {
+        for (size_t j = 0; j <= i; j++) {
+          const auto *begin = static_cast<const char *>(buffs[j]);
+          const size_t bytes = (j < i ? count : done) * elemSize;
+          aggregate.carry[j].insert(aggregate.carry[j].begin(), begin,
+                                    begin + bytes);
+        }
+        if (i > 0 or done > 0) {
+          aggregate.carryTimeNs = timeNs;
+        }
+        return ret;
+      }
+
+      if (i == 0 and done == 0) {
+        timeNs = childTimeNs;
+      }
+      flags |= childFlags;
+      done += static_cast<size_t>(ret);
+    }
+  }
+
+  flags |= SOAPY_SDR_HAS_TIME;
+  return static_cast<int>(count);
+}
+
+int SoapyAirspyHFAggregate::readStreamStatus(SoapySDR::Stream *stream,
+                                             size_t &chanMask, int &flags,
+                                             long long &timeNs,
+                                             const long timeoutUs) {
+  auto &aggregate = *reinterpret_cast<Stream *>(stream);
+
+  // Poll every channel until the timeout, an event on any of them
+  // returns within a millisecond.
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::microseconds(timeoutUs);
+  while (true) {
+    for (size_t i = 0; i < aggregate.streams.size(); i++) {
+      size_t childMask = 0;
+      const int ret = receiver(aggregate.channels[i])
+                          .readStreamStatus(aggregate.streams[i], childMask,
+                                            flags, timeNs, 0);
+      if (ret == 0) {
+        // The receiver's only channel is this stream's channel i.
+        chanMask = (childMask & 1) != 0 ? size_t(1) << i : 0;
+        return 0;
+      }
+    }
+
+    const auto left = deadline - std::chrono::steady_clock::now();
+    if (left <= std::chrono::steady_clock::duration::zero()) {
+      return SOAPY_SDR_TIMEOUT;
+    }
+    std::this_thread::sleep_for(
+        std::min<std::chrono::steady_clock::duration>(
+            left, std::chrono::milliseconds(1)));
+  }
+}
+
+/*******************************************************************
+ * Antenna API
+ ******************************************************************/
+
+std::vector<std::string>
+SoapyAirspyHFAggregate::listAntennas(const int direction,
+                                     const size_t channel) const {
+  return receiver(channel).listAntennas(direction, 0);
+}
+
+void SoapyAirspyHFAggregate::setAntenna(const int direction,
+                                        const size_t channel,
+                                        const std::string &name) {
+  receiver(channel).setAntenna(direction, 0, name);
+}
+
+std::string SoapyAirspyHFAggregate::getAntenna(const int direction,
+                                               const size_t channel) const {
+  return receiver(channel).getAntenna(direction, 0);
+}
+
+/*******************************************************************
+ * Frontend corrections API
+ ******************************************************************/
+
+bool SoapyAirspyHFAggregate::hasIQBalance(const int direction,
+                                          const size_t channel) const {
+  return receiver(channel).hasIQBalance(direction, 0);
+}
+
+void SoapyAirspyHFAggregate::setIQBalance(
+    const int direction, const size_t channel,
+    const std::complex<double> &balance) {
+  receiver(channel).setIQBalance(direction, 0, balance);
+}
+
+std::complex<double>
+SoapyAirspyHFAggregate::getIQBalance(const int direction,
+                                     const size_t channel) const {
+  return receiver(channel).getIQBalance(direction, 0);
+}
+
+bool SoapyAirspyHFAggregate::hasFrequencyCorrection(
+    const int direction, const size_t channel) const {
+  return receiver(channel).hasFrequencyCorrection(direction, 0);
+}
+
+void SoapyAirspyHFAggregate::setFrequencyCorrection(const int direction,
+                                                    const size_t channel,
+                                                    const double value) {
+  receiver(channel).setFrequencyCorrection(direction, 0, value);
+}
+
+double
+SoapyAirspyHFAggregate::getFrequencyCorrection(const int direction,
+                                               const size_t channel) const {
+  return receiver(channel).getFrequencyCorrection(direction, 0);
+}
+
+/*******************************************************************
+ * Gain API
+ ******************************************************************/
+
+std::vector<std::string>
+SoapyAirspyHFAggregate::listGains(const int direction,
+                                  const size_t channel) const {
+  return receiver(channel).listGains(direction, 0);
+}
+
+bool SoapyAirspyHFAggregate::hasGainMode(const int direction,
+                                         const size_t channel) const {
+  return receiver(channel).hasGainMode(direction, 0);
+}
+
+void SoapyAirspyHFAggregate::setGainMode(const int direction,
+                                         const size_t channel,
+                                         const bool automatic) {
+  receiver(channel).setGainMode(direction, 0, automatic);
+}
+
+bool SoapyAirspyHFAggregate::getGainMode(const int direction,
+                                         const size_t channel) const {
+  return receiver(channel).getGainMode(direction, 0);
+}
+
+void SoapyAirspyHFAggregate::setGain(const int direction, const size_t channel,
+                                     const double value) {
+  receiver(channel).setGain(direction, 0, value);
+}
+
+void SoapyAirspyHFAggregate::setGain(const int direction, const size_t channel,
+                                     const std::string &name,
+                                     const double value) {
+  receiver(channel).setGain(direction, 0, name, value);
+}
+
+double SoapyAirspyHFAggregate::getGain(const int direction,
+                                       const size_t channel,
+                                       const std::string &name) const {
+  return receiver(channel).getGain(direction, 0, name);
+}
+
+SoapySDR::Range
+SoapyAirspyHFAggregate::getGainRange(const int direction, const size_t channel,
+                                     const std::string &name) const {
+  return receiver(channel).getGainRange(direction, 0, name);
+}
+
+/*******************************************************************
+ * Frequency API
+ ******************************************************************/
+
+void SoapyAirspyHFAggregate::setFrequency(const int direction,
+                                          const size_t channel,
+                                          const std::string &name,
+                                          const double frequency,
+                                          const SoapySDR::Kwargs &args) {
+  receiver(channel).setFrequency(direction, 0, name, frequency, args);
+}
+
+double SoapyAirspyHFAggregate::getFrequency(const int direction,
+                                            const size_t channel,
+                                            const std::string &name) const {
+  return receiver(channel).getFrequency(direction, 0, name);
+}
+
+std::vector<std::string>
+SoapyAirspyHFAggregate::listFrequencies(const int direction,
+                                        const size_t channel) const {
+  return receiver(channel).listFrequencies(direction, 0);
+}
+
+SoapySDR::RangeList
+SoapyAirspyHFAggregate::getFrequencyRange(const int direction,
+                                          const size_t channel,
+                                          const std::string &name) const {
+  return receiver(channel).getFrequencyRange(direction, 0, name);
+}
+
+/*******************************************************************
+ * Sample Rate API
+ ******************************************************************/
+
+void SoapyAirspyHFAggregate::setSampleRate(const int direction,
+                                           const size_t channel,
+                                           const double rate) {
+  // All channels run at the same rate, lockstep reads need it.
+  (void)channel;
+  for (auto &receiver : receivers_) {
+    receiver->setSampleRate(direction, 0, rate);
+  }
+
+  std::unique_lock<std::mutex> lock(streamsLock_);
+  for (auto &stream : streams_) {
+    stream->rate = rate;
+    stream->realign = true;
+  }
+}
+
+double SoapyAirspyHFAggregate::getSampleRate(const int direction,
+                                             const size_t channel) const {
+  return receiver(channel).getSampleRate(direction, 0);
+}
+
+std::vector<double>
+SoapyAirspyHFAggregate::listSampleRates(const int direction,
+                                        const size_t channel) const {
+  return receiver(channel).listSampleRates(direction, 0);
+}
+
+double SoapyAirspyHFAggregate::getBandwidth(const int direction,
+                                            const size_t channel) const {
+  return receiver(channel).getBandwidth(direction, 0);
+}
+
+std::vector<double>
+SoapyAirspyHFAggregate::listBandwidths(const int direction,
+                                       const size_t channel) const {
+  return receiver(channel).listBandwidths(direction, 0);
+}
+
+/*******************************************************************
+ * Sensor API
+ ******************************************************************/
+
+std::vector<std::string>
+SoapyAirspyHFAggregate::listSensors(const int direction,
+                                    const size_t channel) const {
+  return receiver(channel).listSensors(direction, 0);
+}
+
+SoapySDR::ArgInfo
+SoapyAirspyHFAggregate::getSensorInfo(const int direction,
+                                      const size_t channel,
+                                      const std::string &key) const {
+  return receiver(channel).getSensorInfo(direction, 0, key);
+}
+
+std::string SoapyAirspyHFAggregate::readSensor(const int direction,
+                                               const size_t channel,
+                                               const std::string &key) const {
+  return receiver(channel).readSensor(direction, 0, key);
+}
+
+/*******************************************************************
+ * Settings API
+ ******************************************************************/
+
+SoapySDR::ArgInfoList SoapyAirspyHFAggregate::getSettingInfo(void) const {
+  auto setArgs = receivers_.front()->getSettingInfo();
+
+  SoapySDR::ArgInfo alignArg;
+  alignArg.key = "align";
+  alignArg.value = "";
+  alignArg.name = "Align";
+  alignArg.description = "Align the channels again on the next readStream";
+  alignArg.type = SoapySDR::ArgInfo::STRING;
+  setArgs.push_back(alignArg);
+
+  SoapySDR::ArgInfo alignmentArg;
+  alignmentArg.key = "alignment";
+  alignmentArg.value = "";
+  alignmentArg.name = "Alignment";
+  alignmentArg.description =
+      "Samples dropped and correlation with channel 0, per channel";
+  alignmentArg.type = SoapySDR::ArgInfo::STRING;
+  setArgs.push_back(alignmentArg);
+
+  return setArgs;
+}
+
+void SoapyAirspyHFAggregate::writeSetting(const std::string &key,
+                                          const std::string &value) {
+  if (key == "align") {
+    std::unique_lock<std::mutex> lock(streamsLock_);
+    for (auto &stream : streams_) {
+      stream->realign = true;
+    }
+    return;
+  }
+
+  // Everything else applies to every receiver.
+  for (auto &receiver : receivers_) {
+    receiver->writeSetting(key, value);
+  }
+}
+
+std::string SoapyAirspyHFAggregate::readSetting(const std::string &key) const {
+  if (key == "alignment") {
+    std::unique_lock<std::mutex> lock(streamsLock_);
+    return alignment_;
+  }
+  return receivers_.front()->readSetting(key);
+}
+
+void SoapyAirspyHFAggregate::writeSetting(const int direction,
+                                          const size_t channel,
+                                          const std::string &key,
+                                          const std::string &value) {
+  (void)direction;
+  receiver(channel).writeSetting(key, value);
+}
+
+std::string SoapyAirspyHFAggregate::readSetting(const int direction,
+                                                const size_t channel,
+                                                const std::string &key) const {
+  (void)direction;
+  return receiver(channel).readSetting(key);
+}
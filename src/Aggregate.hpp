@@ -0,0 +1,241 @@
+// Copyright 2024 SM6WJM
+
+#pragma once
+
+#include <SoapySDR/Device.hpp>
+#include <SoapySDR/Types.hpp>
+
+#include <complex>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "SoapyAirspyHF.hpp"
+
+// Several co-located receivers as one device with a channel each, opened
+// with serial=a:b:c. Streams read the receivers in lockstep and return
+// one buffer per channel, with the same sample at the same index.
+//
+// Alignment is done at activation, and again on writeSetting("align").
+// The transfers of each receiver are timed against the host clock, which
+// lines the channels up to within the USB jitter. Then a block of each
+// channel is cross-correlated with channel 0, which needs a signal common
+// to all receivers, e.g. a noise source or a strong station fed through a
+// splitter. The receivers have their own clocks, so they drift apart
+// slowly, realign from time to time. A receiver losing samples makes its
+// channel jump in time, readStream returns SOAPY_SDR_OVERFLOW for it and
+// aligns again.
+class SoapyAirspyHFAggregate : public SoapySDR::Device {
+public:
+  // Lags searched by the cross-correlation, either way, in samples.
+  static constexpr size_t max_lag = 1024;
+  // Samples of each channel correlated.
+  static constexpr size_t reference_samples = 8192;
+  // Normalised correlation below which the channels are taken as having
+  // no common signal, and only the host clock alignment is kept.
+  static constexpr double min_correlation = 0.3;
+  // Between the serials. Not a comma, the device string splits on those.
+  static constexpr char serial_separator = ':';
+
+  explicit SoapyAirspyHFAggregate(const SoapySDR::Kwargs &args);
+  ~SoapyAirspyHFAggregate(void) override;
+
+  SoapyAirspyHFAggregate(const SoapyAirspyHFAggregate &) = delete;
+  SoapyAirspyHFAggregate &operator=(const SoapyAirspyHFAggregate &) = delete;
+
+  /*******************************************************************
+   * Identification API
+   ******************************************************************/
+
+  std::string getDriverKey(void) const override;
+
+  std::string getHardwareKey(void) const override;
+
+  SoapySDR::Kwargs getHardwareInfo(void) const override;
+
+  /*******************************************************************
+   * Channels API
+   ******************************************************************/
+
+  size_t getNumChannels(const int direction) const override;
+
+  /*******************************************************************
+   * Stream API
+   ******************************************************************/
+
+  std::vector<std::string>
+  getStreamFormats(const int direction, const size_t channel) const override;
+
+  std::string getNativeStreamFormat(const int direction, const size_t channel,
+                                    double &fullScale) const override;
+
+  SoapySDR::ArgInfoList getStreamArgsInfo(const int direction,
+                                          const size_t channel) const override;
+
+  SoapySDR::Stream *
+  setupStream(const int direction, const std::string &format,
+              const std::vector<size_t> &channels = std::vector<size_t>(),
+              const SoapySDR::Kwargs &args = SoapySDR::Kwargs()) override;
+
+  void closeStream(SoapySDR::Stream *stream) override;
+
+  size_t getStreamMTU(SoapySDR::Stream *stream) const override;
+
+  int activateStream(SoapySDR::Stream *stream, const int flags = 0,
+                     const long long timeNs = 0,
+                     const size_t numElems = 0) override;
+
+  int deactivateStream(SoapySDR::Stream *stream, const int flags = 0,
+                       const long long timeNs = 0) override;
+
+  int readStream(SoapySDR::Stream *stream, void *const *buffs,
+                 const size_t numElems, int &flags, long long &timeNs,
+                 const long timeoutUs = 100000) override;
+
+  int readStreamStatus(SoapySDR::Stream *stream, size_t &chanMask, int &flags,
+                       long long &timeNs,
+                       const long timeoutUs = 100000) override;
+
+  /*******************************************************************
+   * Antenna API
+   ******************************************************************/
+
+  std::vector<std::string> listAntennas(const int direction,
+                                        const size_t channel) const override;
+
+  void setAntenna(const int direction, const size_t channel,
+                  const std::string &name) override;
+
+  std::string getAntenna(const int direction,
+                         const size_t channel) const override;
+
+  /*******************************************************************
+   * Frontend corrections API
+   ******************************************************************/
+
+  bool hasIQBalance(const int direction, const size_t channel) const override;
+
+  void setIQBalance(const int direction, const size_t channel,
+                    const std::complex<double> &balance) override;
+
+  std::complex<double> getIQBalance(const int direction,
+                                    const size_t channel) const override;
+
+  bool hasFrequencyCorrection(const int direction,
+                              const size_t channel) const override;
+
+  void setFrequencyCorrection(const int direction, const size_t channel,
+                              const double value) override;
+
+  double getFrequencyCorrection(const int direction,
+                                const size_t channel) const override;
+
+  /*******************************************************************
+   * Gain API
+   ******************************************************************/
+
+  std::vector<std::string> listGains(const int direction,
+                                     const size_t channel) const override;
+
+  bool hasGainMode(const int direction, const size_t channel) const override;
+
+  void setGainMode(const int direction, const size_t channel,
+                   const bool automatic) override;
+
+  bool getGainMode(const int direction, const size_t channel) const override;
+
+  void setGain(const int direction, const size_t channel,
+               const double value) override;
+
+  void setGain(const int direction, const size_t channel,
+               const std::string &name, const double value) override;
+
+  double getGain(const int direction, const size_t channel,
+                 const std::string &name) const override;
+
+  SoapySDR::Range getGainRange(const int direction, const size_t channel,
+                               const std::string &name) const override;
+
+  /*******************************************************************
+   * Frequency API
+   ******************************************************************/
+
+  void setFrequency(const int direction, const size_t channel,
+                    const std::string &name, const double frequency,
+                    const SoapySDR::Kwargs &args = SoapySDR::Kwargs()) override;
+
+  double getFrequency(const int direction, const size_t channel,
+                      const std::string &name) const override;
+
+  std::vector<std::string> listFrequencies(const int direction,
+                                           const size_t channel) const override;
+
+  SoapySDR::RangeList getFrequencyRange(const int direction,
+                                        const size_t channel,
+                                        const std::string &name) const override;
+
+  /*******************************************************************
+   * Sample Rate API
+   ******************************************************************/
+
+  void setSampleRate(const int direction, const size_t channel,
+                     const double rate) override;
+
+  double getSampleRate(const int direction,
+                       const size_t channel) const override;
+
+  std::vector<double> listSampleRates(const int direction,
+                                      const size_t channel) const override;
+
+  double getBandwidth(const int direction, const size_t channel) const override;
+
+  std::vector<double> listBandwidths(const int direction,
+                                     const size_t channel) const override;
+
+  /*******************************************************************
+   * Sensor API
+   ******************************************************************/
+
+  std::vector<std::string> listSensors(const int direction,
+                                       const size_t channel) const override;
+
+  SoapySDR::ArgInfo getSensorInfo(const int direction, const size_t channel,
+                                  const std::string &key) const override;
+
+  std::string readSensor(const int direction, const size_t channel,
+                         const std::string &key) const override;
+
+  /*******************************************************************
+   * Settings API
+   ******************************************************************/
+
+  SoapySDR::ArgInfoList getSettingInfo(void) const override;
+
+  void writeSetting(const std::string &key, const std::string &value) override;
+
+  std::string readSetting(const std::string &key) const override;
+
+  void writeSetting(const int direction, const size_t channel,
+                    const std::string &key, const std::string &value) override;
+
+  std::string readSetting(const int direction, const size_t channel,
+                          const std::string &key) const override;
+
+private:
+  struct Stream;
+
+  // Receiver of a channel, throws if there is none.
+  SoapyAirspyHF &receiver(size_t channel) const;
+
+  // Line up the channels of stream, see the class comment.
+  int align(Stream &stream, long timeoutUs);
+
+  std::vector<std::string> serials_;
+  std::vector<std::unique_ptr<SoapyAirspyHF>> receivers_;
+
+  // Streams, and the result of the last alignment for readSetting.
+  mutable std::mutex streamsLock_;
+  std::vector<std::unique_ptr<Stream>> streams_;
+  std::string alignment_;
+};
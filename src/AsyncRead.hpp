@@ -0,0 +1,293 @@
+// Copyright 2024 SM6WJM
+
+// Reading the streams of many devices from one thread, instead of a
+// thread blocked in readStream per device. Installed with the module,
+// include it from your application. Needs C++17, async_read() C++20.
+//
+// Give each stream an eventfd in the ready_fd stream arg. When a
+// readStream with a zero timeout times out, the driver signals the fd as
+// soon as the samples are there. It's also signalled on deactivation, and
+// with AIRSPYHF_READY_CLOSED added when the stream is closed. AsyncLoop
+// waits for the fds and retries, so every read goes through readStream
+// with its overflow, settling, timestamp and event handling.
+//
+//   AsyncLoop loop;
+//   const int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+//   auto *stream = device->setupStream(SOAPY_SDR_RX, "CF32", {0},
+//                                      {{"ready_fd", std::to_string(fd)}});
+//   device->activateStream(stream);
+//   loop.read(device, stream, fd, buffs, 4096, 100000,
+//             [](const AsyncResult &result) { ... });
+//   while (loop.pending()) loop.run_once();
+//
+// or from a coroutine:
+//
+//   const AsyncResult result =
+//       co_await async_read(loop, device, stream, fd, buffs, 4096, 100000);
+//
+// One eventfd per stream, closed only after closeStream. Not thread safe,
+// use a loop from one thread only.
+
+#pragma once
+
+#include <SoapySDR/Device.hpp>
+#include <SoapySDR/Errors.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#if __cplusplus >= 202002L && __has_include(<coroutine>)
+#include <coroutine>
+#endif
+
+// Added to the ready fd when the stream is closed. Readiness adds 1 per
+// signal, which never gets near.
+inline constexpr uint64_t AIRSPYHF_READY_CLOSED = uint64_t(1) << 32;
+
+// Outcome of a read, as returned by readStream.
+struct AsyncResult {
+  int ret;
+  int flags;
+  long long timeNs;
+};
+
+class AsyncLoop {
+public:
+  using Clock = std::chrono::steady_clock;
+  using Done = std::function<void(const AsyncResult &)>;
+
+  AsyncLoop() : epoll_(epoll_create1(EPOLL_CLOEXEC)) {
+    if (epoll_ == -1) {
+      throw std::runtime_error("Could not create epoll: " +
+                               std::string(strerror(errno)));
+    }
+  }
+
+  ~AsyncLoop() { close(epoll_); }
+
+  AsyncLoop(const AsyncLoop &) = delete;
+  AsyncLoop &operator=(const AsyncLoop &) = delete;
+
+  // Readable when run_once() has ready fds, for nesting in another loop.
+  int fd() const noexcept { return epoll_; }
+
+  // Reads still waiting.
+  size_t pending() const noexcept {
+    size_t count = 0;
+    for (const auto &entry : waiting_) {
+      count += entry.second.size();
+    }
+    return count;
+  }
+
+  // Read up to numElems into buffs within timeoutUs and pass the result
+  // to done. Tried at once, done may be called before read returns.
+  void read(SoapySDR::Device *device, SoapySDR::Stream *stream,
+            const int readyFd, void *const *buffs, const size_t numElems,
+            const long timeoutUs, Done done) {
+    Read read{device, stream, buffs, numElems,
+              Clock::now() + std::chrono::microseconds(timeoutUs),
+              std::move(done)};
+    if (not attempt(read)) {
+      wait(readyFd, std::move(read));
+    }
+  }
+
+  // As read(), without trying first. For callers that just got a
+  // timeout from readStream, which armed the fd.
+  void wait(SoapySDR::Device *device, SoapySDR::Stream *stream,
+            const int readyFd, void *const *buffs, const size_t numElems,
+            const Clock::time_point deadline, Done done) {
+    wait(readyFd,
+         Read{device, stream, buffs, numElems, deadline, std::move(done)});
+  }
+
+  // Wait up to timeoutMs, -1 for ever, for ready fds and retry their
+  // reads. Returns the number of reads completed, timed out ones too.
+  size_t run_once(const int timeoutMs = -1) {
+    if (waiting_.empty()) {
+      return 0;
+    }
+
+    // Wake for the earliest deadline
+    auto deadline = Clock::time_point::max();
+    for (const auto &entry : waiting_) {
+      for (const auto &read : entry.second) {
+        deadline = std::min(deadline, read.deadline);
+      }
+    }
+    const auto untilDeadline =
+        std::chrono::ceil<std::chrono::milliseconds>(deadline - Clock::now())
+            .count();
+    int waitMs = static_cast<int>(std::clamp<long long>(
+        untilDeadline, 0, std::numeric_limits<int>::max()));
+    if (timeoutMs >= 0) {
+      waitMs = std::min(waitMs, timeoutMs);
+    }
+
+    std::array<epoll_event, 16> events;
+    int ready = epoll_wait(epoll_, events.data(),
+                           static_cast<int>(events.size()), waitMs);
+    if (ready == -1 and errno != EINTR) {
+      throw std::runtime_error("epoll_wait failed: " +
+                               std::string(strerror(errno)));
+    }
+
+    size_t completed = 0;
+    for (int i = 0; i < ready; i++) {
+      const int fd = events.at(static_cast<size_t>(i)).data.fd;
+      uint64_t count = 0;
+      if (::read(fd, &count, sizeof(count)) != sizeof(count)) {
+        count = 0;
+      }
+
+      const auto it = waiting_.find(fd);
+      if (it == waiting_.end()) {
+        continue;
+      }
+      auto reads = std::move(it->second);
+      waiting_.erase(it);
+
+      // Done may start the next read on the same fd, keep ours apart.
+      std::vector<Read> again;
+      for (auto &read : reads) {
+        if (count >= AIRSPYHF_READY_CLOSED) {
+          read.done({SOAPY_SDR_STREAM_ERROR, 0, 0});
+          completed++;
+        } else if (attempt(read)) {
+          completed++;
+        } else {
+          again.push_back(std::move(read));
+        }
+      }
+      for (auto &read : again) {
+        waiting_[fd].push_back(std::move(read));
+      }
+    }
+
+    // Collect before calling, done may add reads.
+    const auto now = Clock::now();
+    std::vector<Read> expired;
+    for (auto it = waiting_.begin(); it != waiting_.end();) {
+      auto &reads = it->second;
+      const auto late = std::stable_partition(
+          reads.begin(), reads.end(),
+          [&](const Read &read) { return read.deadline > now; });
+      std::move(late, reads.end(), std::back_inserter(expired));
+      reads.erase(late, reads.end());
+      it = reads.empty() ? waiting_.erase(it) : std::next(it);
+    }
+    for (auto &read : expired) {
+      read.done({SOAPY_SDR_TIMEOUT, 0, 0});
+      completed++;
+    }
+
+    return completed;
+  }
+
+private:
+  struct Read {
+    SoapySDR::Device *device;
+    SoapySDR::Stream *stream;
+    void *const *buffs;
+    size_t numElems;
+    Clock::time_point deadline;
+    Done done;
+  };
+
+  // Non-blocking readStream, true and done called unless it timed out
+  // with time left.
+  static bool attempt(Read &read) {
+    AsyncResult result{0, 0, 0};
+    result.ret = read.device->readStream(read.stream, read.buffs,
+                                         read.numElems, result.flags,
+                                         result.timeNs, 0);
+    if (result.ret == SOAPY_SDR_TIMEOUT and Clock::now() < read.deadline) {
+      return false;
+    }
+    read.done(result);
+    return true;
+  }
+
+  void wait(const int fd, Read read) {
+    // Closing an fd drops it from epoll, so add it every time.
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &event) == -1 and
+        errno != EEXIST) {
+      read.done({SOAPY_SDR_STREAM_ERROR, 0, 0});
+      return;
+    }
+    waiting_[fd].push_back(std::move(read));
+  }
+
+  int epoll_;
+  std::map<int, std::vector<Read>> waiting_;
+};
+
+#if __cplusplus >= 202002L && __has_include(<coroutine>)
+
+// co_await for AsyncLoop::read(), resumed from AsyncLoop::run_once().
+class ReadAwaitable {
+public:
+  ReadAwaitable(AsyncLoop &loop, SoapySDR::Device *device,
+                SoapySDR::Stream *stream, const int readyFd,
+                void *const *buffs, const size_t numElems,
+                const long timeoutUs)
+      : loop_(loop), device_(device), stream_(stream), readyFd_(readyFd),
+        buffs_(buffs), numElems_(numElems),
+        deadline_(AsyncLoop::Clock::now() +
+                  std::chrono::microseconds(timeoutUs)) {}
+
+  bool await_ready() {
+    result_.ret = device_->readStream(stream_, buffs_, numElems_,
+                                      result_.flags, result_.timeNs, 0);
+    return result_.ret != SOAPY_SDR_TIMEOUT or
+           AsyncLoop::Clock::now() >= deadline_;
+  }
+
+  void await_suspend(std::coroutine_handle<> handle) {
+    loop_.wait(device_, stream_, readyFd_, buffs_, numElems_, deadline_,
+               [this, handle](const AsyncResult &result) {
+                 result_ = result;
+                 handle.resume();
+               });
+  }
+
+  AsyncResult await_resume() const noexcept { return result_; }
+
+private:
+  AsyncLoop &loop_;
+  SoapySDR::Device *device_;
+  SoapySDR::Stream *stream_;
+  int readyFd_;
+  void *const *buffs_;
+  size_t numElems_;
+  AsyncLoop::Clock::time_point deadline_;
+  AsyncResult result_{0, 0, 0};
+};
+
+inline ReadAwaitable async_read(AsyncLoop &loop, SoapySDR::Device *device,
+                                SoapySDR::Stream *stream, const int readyFd,
+                                void *const *buffs, const size_t numElems,
+                                const long timeoutUs) {
+  return {loop, device, stream, readyFd, buffs, numElems, timeoutUs};
+}
+
+#endif
@@ -0,0 +1,74 @@
+// Copyright 2024 SM6WJM
+
+#include "Calibration.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+Calibration::Calibration(const std::string &path) {
+  std::ifstream file(path);
+  if (not file) {
+    throw std::runtime_error("Could not open calibration file " + path);
+  }
+
+  std::string line;
+  size_t number = 0;
+  while (std::getline(file, line)) {
+    number++;
+
+    // Strip comments and skip blank lines
+    line = line.substr(0, line.find('#'));
+    if (line.find_first_not_of(" \t\r") == std::string::npos) {
+      continue;
+    }
+
+    std::istringstream fields(line);
+    CalibrationPoint point{};
+    if (not(fields >> point.frequency >> point.gainDb >> point.iqPoint >>
+            point.ppm)) {
+      throw std::runtime_error("Invalid calibration point at " + path + ":" +
+                               std::to_string(number));
+    }
+    points_.push_back(point);
+  }
+
+  if (points_.empty()) {
+    throw std::runtime_error("No calibration points in " + path);
+  }
+
+  std::sort(points_.begin(), points_.end(),
+            [](const CalibrationPoint &a, const CalibrationPoint &b) {
+              return a.frequency < b.frequency;
+            });
+}
+
+CalibrationPoint Calibration::lookup(const double frequency) const {
+  // Upper point of the interval
+  const auto upper = static_cast<size_t>(
+      std::upper_bound(points_.begin(), points_.end(), frequency,
+                       [](const double f, const CalibrationPoint &p) {
+                         return f < p.frequency;
+                       }) -
+      points_.begin());
+
+  // Outside the table
+  if (upper == 0) {
+    return points_.front();
+  }
+  if (upper == points_.size()) {
+    return points_.back();
+  }
+
+  const auto &a = points_[upper - 1];
+  const auto &b = points_[upper];
+  const double t = (frequency - a.frequency) / (b.frequency - a.frequency);
+
+  CalibrationPoint point;
+  point.frequency = frequency;
+  point.gainDb = a.gainDb + t * (b.gainDb - a.gainDb);
+  point.iqPoint = a.iqPoint + t * (b.iqPoint - a.iqPoint);
+  point.ppm = a.ppm + t * (b.ppm - a.ppm);
+  return point;
+}
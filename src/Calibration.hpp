@@ -0,0 +1,40 @@
+// Copyright 2024 SM6WJM
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Calibration at one frequency.
+struct CalibrationPoint {
+  double frequency;
+  // Receiver gain above nominal, a signal reads this much higher in dBFS.
+  double gainDb;
+  // libairspyhf optimal IQ correction point.
+  double iqPoint;
+  // Reference clock correction.
+  double ppm;
+};
+
+// Per frequency calibration table, see the calibration device arg. A text
+// file with one point per line, comments start with #:
+//
+//   # frequency_hz  gain_db  iq_point  ppm
+//   1000000         -1.5     0.0       0.3
+//
+// Values between points are interpolated linearly, outside the table the
+// nearest point is used.
+class Calibration {
+  // Sorted by frequency
+  std::vector<CalibrationPoint> points_;
+
+public:
+  // Throws std::runtime_error if the file can't be read or parsed.
+  explicit Calibration(const std::string &path);
+
+  size_t size() const noexcept { return points_.size(); }
+
+  // Calibration at frequency, O(log n). Safe from several threads.
+  CalibrationPoint lookup(double frequency) const;
+};
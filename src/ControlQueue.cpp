@@ -0,0 +1,82 @@
+// Copyright 2024 SM6WJM
+
+#include "ControlQueue.hpp"
+
+#include <SoapySDR/Logger.hpp>
+
+#include <algorithm>
+#include <exception>
+
+ControlQueue::ControlQueue() : running_(true), busy_(false), coalesced_(0) {
+  thread_ = std::thread(&ControlQueue::run, this);
+}
+
+ControlQueue::~ControlQueue() {
+  {
+    std::unique_lock<std::mutex> lock(lock_);
+    running_ = false;
+  }
+  wake_.notify_one();
+  thread_.join();
+}
+
+void ControlQueue::post(const std::string &key, std::function<void()> command) {
+  {
+    std::unique_lock<std::mutex> lock(lock_);
+    const auto it =
+        std::find_if(pending_.begin(), pending_.end(),
+                     [&key](const auto &entry) { return entry.first == key; });
+    if (it != pending_.end()) {
+      it->second = std::move(command);
+      coalesced_++;
+      return;
+    }
+    pending_.emplace_back(key, std::move(command));
+  }
+  wake_.notify_one();
+}
+
+size_t ControlQueue::pending() {
+  std::unique_lock<std::mutex> lock(lock_);
+  return pending_.size() + (busy_ ? 1 : 0);
+}
+
+size_t ControlQueue::coalesced() {
+  std::unique_lock<std::mutex> lock(lock_);
+  return coalesced_;
+}
+
+bool ControlQueue::flush(const std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lock(lock_);
+  return idle_.wait_for(lock, timeout,
+                        [this] { return pending_.empty() and not busy_; });
+}
+
+void ControlQueue::run() {
+  std::unique_lock<std::mutex> lock(lock_);
+
+  // Run what's pending even when stopping, the last settings must stick.
+  while (running_ or not pending_.empty()) {
+    if (pending_.empty()) {
+      wake_.wait(lock, [this] { return not running_ or not pending_.empty(); });
+      continue;
+    }
+
+    auto command = std::move(pending_.front().second);
+    pending_.erase(pending_.begin());
+    busy_ = true;
+
+    lock.unlock();
+    try {
+      command();
+    } catch (const std::exception &e) {
+      SoapySDR::logf(SOAPY_SDR_ERROR, "ControlQueue: %s", e.what());
+    }
+    lock.lock();
+
+    busy_ = false;
+    if (pending_.empty()) {
+      idle_.notify_all();
+    }
+  }
+}
@@ -0,0 +1,52 @@
+// Copyright 2024 SM6WJM
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Runs control commands (USB control transfers) on its own thread so that
+// setters return at once. Commands are keyed, a command replaces a pending
+// one with the same key: when a tuner is dragged only the latest frequency
+// is sent. Commands with different keys run in the order first posted.
+class ControlQueue {
+  std::mutex lock_;
+  std::condition_variable wake_;
+  std::condition_variable idle_;
+  bool running_;
+  // Pending commands in order, at most one per key.
+  std::vector<std::pair<std::string, std::function<void()>>> pending_;
+  bool busy_;
+  size_t coalesced_;
+
+  std::thread thread_;
+
+  void run();
+
+public:
+  ControlQueue();
+  // Runs the pending commands before returning.
+  ~ControlQueue();
+
+  ControlQueue(const ControlQueue &) = delete;
+  ControlQueue &operator=(const ControlQueue &) = delete;
+
+  // Queue command, replacing a pending command with the same key.
+  void post(const std::string &key, std::function<void()> command);
+
+  // Commands pending or running.
+  size_t pending();
+
+  // Commands replaced before they ran.
+  size_t coalesced();
+
+  // Wait until all commands posted so far have run, false on timeout.
+  bool flush(std::chrono::milliseconds timeout);
+};
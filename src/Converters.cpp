@@ -0,0 +1,203 @@
+// Copyright 2024 SM6WJM
+
+#include "Converters.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// The loops below are written without branches or loop carried state so
+// the compiler can vectorise them (NEON on ARM, SSE/AVX on x86). This file
+// is built with -ffast-math, see CMakeLists.txt.
+
+// Dither sequence counter, per thread since converters are stateless.
+static thread_local uint32_t dither_counter = 0;
+
+// Integer hash, a cheap vectorisable source of uniform noise.
+static inline uint32_t hash(uint32_t x) {
+  x ^= x >> 16;
+  x *= 0x7feb352dU;
+  x ^= x >> 15;
+  x *= 0x846ca68bU;
+  x ^= x >> 16;
+  return x;
+}
+
+// Triangular noise in (-1, 1) LSB, the sum of two uniform values.
+static inline float tpdf(const uint32_t n) {
+  const float scale = 1.0f / 16777216.0f; // 2^-24
+  const auto a = static_cast<float>(hash(2 * n) >> 8);
+  const auto b = static_cast<float>(hash(2 * n + 1) >> 8);
+  return (a + b) * scale - 1.0f;
+}
+
+// Scale, dither, clamp and round one component. Rounds by truncating a
+// positive value, floor() doesn't vectorise everywhere.
+static inline int32_t quantise(const float value, const float scale,
+                               const float max, const uint32_t n) {
+  const float v = std::min(std::max(value * scale + tpdf(n), -max), max);
+  const float offset = max + 1.0f;
+  return static_cast<int32_t>(v + offset + 0.5f) -
+         static_cast<int32_t>(offset);
+}
+
+void convertCF32toCS12Dither(const void *src, void *dst, const size_t num,
+                             const double scaler) {
+  const float *in = static_cast<const float *>(src);
+  uint8_t *out = static_cast<uint8_t *>(dst);
+
+  const float max = 2047.0f;
+  const float scale = static_cast<float>(scaler) * max;
+
+  // Quantise a chunk at a time (vectorised), then pack (scalar).
+  const size_t chunk = 256;
+  int32_t quantised[2 * chunk];
+
+  for (size_t done = 0; done < num; done += chunk) {
+    const size_t count = std::min(chunk, num - done);
+    const uint32_t base = dither_counter;
+
+    for (size_t i = 0; i < 2 * count; i++) {
+      quantised[i] = quantise(in[2 * done + i], scale, max,
+                              base + static_cast<uint32_t>(i));
+    }
+
+    // Three bytes per sample: I[7:0], Q[3:0]I[11:8], Q[11:4]
+    for (size_t i = 0; i < count; i++) {
+      const auto re = static_cast<uint32_t>(quantised[2 * i]) & 0xfff;
+      const auto im = static_cast<uint32_t>(quantised[2 * i + 1]) & 0xfff;
+      uint8_t *p = out + 3 * (done + i);
+      p[0] = static_cast<uint8_t>(re);
+      p[1] = static_cast<uint8_t>((re >> 8) | (im << 4));
+      p[2] = static_cast<uint8_t>(im >> 4);
+    }
+
+    dither_counter = base + static_cast<uint32_t>(2 * count);
+  }
+}
+
+void convertCF32toCS8Dither(const void *src, void *dst, const size_t num,
+                            const double scaler) {
+  const float *in = static_cast<const float *>(src);
+  int8_t *out = static_cast<int8_t *>(dst);
+
+  const float max = 127.0f;
+  const float scale = static_cast<float>(scaler) * max;
+  const uint32_t base = dither_counter;
+
+  for (size_t i = 0; i < 2 * num; i++) {
+    out[i] = static_cast<int8_t>(
+        quantise(in[i], scale, max, base + static_cast<uint32_t>(i)));
+  }
+
+  dither_counter = base + static_cast<uint32_t>(2 * num);
+}
+
+float peakCF32(const void *src, const size_t num) {
+  const float *in = static_cast<const float *>(src);
+
+  float peak = 0;
+  for (size_t i = 0; i < 2 * num; i++) {
+    peak = std::max(peak, std::fabs(in[i]));
+  }
+
+  return peak;
+}
+
+float sumPowerCF32(const void *src, const size_t num) {
+  const float *in = static_cast<const float *>(src);
+
+  float sum = 0;
+  for (size_t i = 0; i < 2 * num; i++) {
+    sum += in[i] * in[i];
+  }
+
+  return sum;
+}
+
+void gainRampCF32(const void *src, void *dst, const size_t num,
+                  const float gain0, const float gain1) {
+  const float *in = static_cast<const float *>(src);
+  float *out = static_cast<float *>(dst);
+
+  const float step = num > 0 ? (gain1 - gain0) / static_cast<float>(num) : 0;
+
+  // int rather than size_t index, there's no vector conversion from 64 bit
+  // integers on SSE2.
+  const auto count = static_cast<int32_t>(num);
+  for (int32_t i = 0; i < count; i++) {
+    const float gain = gain0 + step * static_cast<float>(i);
+    out[2 * i] = in[2 * i] * gain;
+    out[2 * i + 1] = in[2 * i + 1] * gain;
+  }
+}
+
+void firCF32(const void *src, void *dst, const size_t num, const float *taps,
+             const size_t count) {
+  const float *in = static_cast<const float *>(src);
+  float *out = static_cast<float *>(dst);
+
+  // Outer loop over taps so the inner loop runs over samples, which
+  // vectorises.
+  for (size_t i = 0; i < 2 * num; i++) {
+    out[i] = 0;
+  }
+
+  for (size_t k = 0; k < count; k++) {
+    const float re = taps[2 * k];
+    const float im = taps[2 * k + 1];
+    const float *x = in + 2 * k;
+    for (size_t i = 0; i < num; i++) {
+      out[2 * i] += re * x[2 * i] - im * x[2 * i + 1];
+      out[2 * i + 1] += re * x[2 * i + 1] + im * x[2 * i];
+    }
+  }
+}
+
+BlockStats copyCF32WithStats(const void *src, void *dst, const size_t num,
+                             const float clipLevel) {
+  const float *in = static_cast<const float *>(src);
+  float *out = static_cast<float *>(dst);
+
+  float peak = 0;
+  float sum = 0;
+  uint32_t clipped = 0;
+  // Samples at or above each band's lower edge, -6 dB (1/4 in power) per
+  // band. Counted with compares rather than indexed increments, so the
+  // loop vectorises.
+  uint32_t above[BlockStats::bands - 1] = {};
+
+  for (size_t i = 0; i < num; i++) {
+    const float re = in[2 * i];
+    const float im = in[2 * i + 1];
+    out[2 * i] = re;
+    out[2 * i + 1] = im;
+
+    const float power = re * re + im * im;
+    peak = std::max(peak, power);
+    sum += power;
+    clipped += (std::fabs(re) >= clipLevel) | (std::fabs(im) >= clipLevel);
+
+    float edge = 0.25f;
+    for (size_t b = 0; b < BlockStats::bands - 1; b++) {
+      above[b] += power >= edge;
+      edge *= 0.25f;
+    }
+  }
+
+  BlockStats stats;
+  stats.samples = num;
+  stats.peakPower = peak;
+  stats.sumPower = sum;
+  stats.clipped = clipped;
+
+  uint32_t previous = 0;
+  for (size_t b = 0; b < BlockStats::bands - 1; b++) {
+    stats.histogram[b] = above[b] - previous;
+    previous = above[b];
+  }
+  stats.histogram[BlockStats::bands - 1] =
+      static_cast<uint32_t>(num) - previous;
+
+  return stats;
+}
@@ -0,0 +1,55 @@
+// Copyright 2024 SM6WJM
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Driver converters from the native CF32 format. They have the signature of
+// SoapySDR::ConverterRegistry::ConverterFunction but are not registered
+// globally, they are only used by this driver's streams.
+
+// CF32 to packed CS12 with TPDF dither, scaler multiplies the input.
+void convertCF32toCS12Dither(const void *src, void *dst, const size_t num,
+                             const double scaler);
+
+// CF32 to CS8 with TPDF dither, scaler multiplies the input.
+void convertCF32toCS8Dither(const void *src, void *dst, const size_t num,
+                            const double scaler);
+
+// Largest absolute value of any component.
+float peakCF32(const void *src, const size_t num);
+
+// Sum of the power, |z|^2, of all samples.
+float sumPowerCF32(const void *src, const size_t num);
+
+// Multiply CF32 samples by a gain going linearly from gain0 at the first
+// sample towards gain1 after the last.
+void gainRampCF32(const void *src, void *dst, const size_t num,
+                  const float gain0, const float gain1);
+
+// Complex FIR filter. src holds num + count - 1 samples, the first count - 1
+// from before the block, taps holds count interleaved complex taps in
+// time order.
+void firCF32(const void *src, void *dst, const size_t num, const float *taps,
+             const size_t count);
+
+// Signal statistics of one block of CF32 samples.
+struct BlockStats {
+  // Histogram bands are 6 dB wide, from full scale down. The last band
+  // holds everything below.
+  static constexpr size_t bands = 8;
+
+  size_t samples = 0;
+  // Largest and summed power, |z|^2, full scale is 1.0.
+  float peakPower = 0;
+  float sumPower = 0;
+  // Samples with I or Q at or above the clip level.
+  uint32_t clipped = 0;
+  // Samples per band, histogram[0] is 0 to -6 dBFS.
+  uint32_t histogram[bands] = {};
+};
+
+// Copy CF32 samples and return their statistics, in one pass.
+BlockStats copyCF32WithStats(const void *src, void *dst, const size_t num,
+                             const float clipLevel);
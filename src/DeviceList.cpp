@@ -0,0 +1,114 @@
+// Copyright 2024 SM6WJM
+
+#include "DeviceList.hpp"
+
+#include "SoapyAirspyHF.hpp"
+
+#include <SoapySDR/Logger.hpp>
+
+#ifdef HAVE_LIBUSB_HOTPLUG
+// AirspyHF+ USB ids, as in libairspyhf
+static constexpr int airspyhf_vid = 0x03EB;
+static constexpr int airspyhf_pid = 0x800C;
+#endif
+
+DeviceList &DeviceList::instance() {
+  static DeviceList list;
+  return list;
+}
+
+DeviceList::DeviceList() : stale_(true), hotplug_(false) {
+#ifdef HAVE_LIBUSB_HOTPLUG
+  context_ = nullptr;
+  running_ = false;
+
+  if (not libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG) or
+      libusb_init(&context_) != LIBUSB_SUCCESS) {
+    SoapySDR::logf(SOAPY_SDR_DEBUG, "DeviceList: no hotplug support");
+    context_ = nullptr;
+    return;
+  }
+
+  const int ret = libusb_hotplug_register_callback(
+      context_,
+      LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
+      LIBUSB_HOTPLUG_NO_FLAGS, airspyhf_vid, airspyhf_pid,
+      LIBUSB_HOTPLUG_MATCH_ANY, &DeviceList::hotplug, this, &callback_);
+  if (ret != LIBUSB_SUCCESS) {
+    SoapySDR::logf(SOAPY_SDR_WARNING,
+                   "libusb_hotplug_register_callback() failed: %s",
+                   libusb_error_name(ret));
+    libusb_exit(context_);
+    context_ = nullptr;
+    return;
+  }
+
+  hotplug_ = true;
+  running_ = true;
+  thread_ = std::thread(&DeviceList::run, this);
+#endif
+}
+
+DeviceList::~DeviceList() {
+#ifdef HAVE_LIBUSB_HOTPLUG
+  if (context_) {
+    running_ = false;
+    libusb_hotplug_deregister_callback(context_, callback_);
+    thread_.join();
+    libusb_exit(context_);
+  }
+#endif
+}
+
+#ifdef HAVE_LIBUSB_HOTPLUG
+// Only flag the change, libusb doesn't allow opening devices from here.
+int LIBUSB_CALL DeviceList::hotplug(libusb_context *, libusb_device *,
+                                    libusb_hotplug_event event, void *self) {
+  SoapySDR::logf(SOAPY_SDR_DEBUG, "DeviceList: AirspyHF %s",
+                 event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED ? "arrived"
+                                                              : "left");
+  static_cast<DeviceList *>(self)->stale_ = true;
+  return 0;
+}
+
+void DeviceList::run() {
+  while (running_) {
+    timeval timeout = {0, 100'000};
+    libusb_handle_events_timeout_completed(context_, &timeout, nullptr);
+  }
+}
+#endif
+
+std::vector<uint64_t> DeviceList::serials() {
+  std::unique_lock<std::mutex> lock(lock_);
+
+  const auto now = std::chrono::steady_clock::now();
+  if (not stale_ and (hotplug_ or now - listed_ < max_age)) {
+    return serials_;
+  }
+
+  // Clear first, a hotplug event during the listing marks it stale again.
+  stale_ = false;
+
+  // Count, then list. Again if one was plugged in between.
+  int count = airspyhf_list_devices(nullptr, 0);
+  while (count >= 0) {
+    serials_.resize(static_cast<size_t>(count) + 1);
+    const int listed = airspyhf_list_devices(serials_.data(), count + 1);
+    if (listed <= count) {
+      count = listed;
+      break;
+    }
+    count = listed;
+  }
+  if (count < 0) {
+    SoapySDR::logf(SOAPY_SDR_ERROR, "libairspyhf error listing devices");
+    serials_.clear();
+    stale_ = true;
+    return {};
+  }
+
+  serials_.resize(static_cast<size_t>(count));
+  listed_ = now;
+  return serials_;
+}
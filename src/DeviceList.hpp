@@ -0,0 +1,57 @@
+// Copyright 2024 SM6WJM
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef HAVE_LIBUSB_HOTPLUG
+#include <libusb.h>
+#endif
+
+// Serial numbers of the attached devices, for findAirspyHF. Listing opens
+// every device, so the list is kept between enumerations. With libusb
+// hotplug support it's listed again only after a device came or went,
+// otherwise when it's older than max_age.
+class DeviceList {
+  std::mutex lock_;
+  std::vector<uint64_t> serials_;
+  std::chrono::steady_clock::time_point listed_;
+  // Set when the list must be read again.
+  std::atomic<bool> stale_;
+  bool hotplug_;
+
+#ifdef HAVE_LIBUSB_HOTPLUG
+  libusb_context *context_;
+  libusb_hotplug_callback_handle callback_;
+  std::atomic<bool> running_;
+  std::thread thread_;
+
+  static int LIBUSB_CALL hotplug(libusb_context *context,
+                                 libusb_device *device,
+                                 libusb_hotplug_event event, void *self);
+  void run();
+#endif
+
+  DeviceList();
+
+public:
+  // Without hotplug, how long a listing is trusted.
+  static constexpr std::chrono::milliseconds max_age{1000};
+
+  static DeviceList &instance();
+  ~DeviceList();
+
+  DeviceList(const DeviceList &) = delete;
+  DeviceList &operator=(const DeviceList &) = delete;
+
+  // Attached devices, from the cache when it's current.
+  std::vector<uint64_t> serials();
+
+  // Read the list again on the next call, e.g. after a failed open.
+  void invalidate() { stale_ = true; }
+};
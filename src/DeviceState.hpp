@@ -0,0 +1,29 @@
+// Copyright 2024 SM6WJM
+
+#pragma once
+
+#include <complex>
+#include <cstdint>
+
+// Device settings, as reported by the getters.
+struct DeviceState {
+  uint32_t sampleRate = 0;
+  uint32_t centerFrequency = 0;
+
+  bool enableDSP = true;
+  bool agcEnabled = true;
+  double lnaGain = 0;
+  double hfAttenuation = 0;
+
+  // In ppb
+  double frequencyCorrection = 0;
+  std::complex<double> iqBalance = 0;
+
+  // Calibrated gain offset and IQ correction point at the current
+  // frequency, see Calibration.
+  double calibrationGainDb = 0;
+  double calibrationIqPoint = 0;
+  // Calibrated clock correction in ppb, the device runs with it added to
+  // frequencyCorrection.
+  double calibrationPpb = 0;
+};
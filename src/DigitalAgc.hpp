@@ -0,0 +1,73 @@
+// Copyright 2024 SM6WJM
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#include "Converters.hpp"
+
+// Digital AGC on CF32 samples, see the agc stream arg. Normalises the RMS
+// level of each block to a target, the gain follows with separate attack
+// and decay time constants. The gain never makes a component exceed full
+// scale: it drops at once, for the whole block, when it would, and rises
+// as a ramp across the block otherwise.
+class DigitalAgc {
+  // Limits of the gain, +-100 dB.
+  static constexpr float max_gain = 1e5f;
+  static constexpr float min_gain = 1e-5f;
+
+  float level_;
+  double attack_;
+  double decay_;
+  float gain_;
+
+  // Output of the last block.
+  std::vector<float> buffer_;
+
+public:
+  // Target RMS level in dBFS, attack and decay time constants in seconds.
+  DigitalAgc(const double levelDb, const double attack, const double decay)
+      : level_(static_cast<float>(std::pow(10.0, levelDb / 10))),
+        attack_(attack), decay_(decay), gain_(1) {}
+
+  // Gain at the end of the last block.
+  float gain() const noexcept { return gain_; }
+
+  // Apply the gain to num samples, returns the result which is valid until
+  // the next call.
+  const void *process(const void *src, const size_t num,
+                      const double samplerate) {
+    buffer_.resize(2 * num);
+    if (num == 0) {
+      return buffer_.data();
+    }
+
+    const float power = sumPowerCF32(src, num) / static_cast<float>(num);
+    const float peak = peakCF32(src, num);
+
+    float target = std::sqrt(level_ / std::max(power, 1e-20f));
+    target = std::clamp(target, min_gain, max_gain);
+
+    // One pole smoothing per block
+    const double duration = static_cast<double>(num) / samplerate;
+    const double tau = target < gain_ ? attack_ : decay_;
+    const auto alpha = static_cast<float>(1 - std::exp(-duration / tau));
+    float gain = gain_ + alpha * (target - gain_);
+
+    // Never clip
+    if (peak > 0) {
+      gain = std::min(gain, 1.0f / peak);
+    }
+
+    // Falling gain applies to the whole block, so the peak can't clip at
+    // its start.
+    const float gain0 = gain < gain_ ? gain : gain_;
+    gainRampCF32(src, buffer_.data(), num, gain0, gain);
+    gain_ = gain;
+
+    return buffer_.data();
+  }
+};
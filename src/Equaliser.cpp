@@ -0,0 +1,110 @@
+// Copyright 2024 SM6WJM
+
+#include "Equaliser.hpp"
+
+#include "Converters.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+PassbandTables::PassbandTables(const std::string &path) {
+  std::ifstream file(path);
+  if (not file) {
+    throw std::runtime_error("Could not open equaliser file " + path);
+  }
+
+  std::string line;
+  size_t number = 0;
+  while (std::getline(file, line)) {
+    number++;
+
+    // Strip comments and skip blank lines
+    line = line.substr(0, line.find('#'));
+    if (line.find_first_not_of(" \t\r") == std::string::npos) {
+      continue;
+    }
+
+    std::istringstream fields(line);
+    uint32_t rate = 0;
+    std::vector<float> response;
+    float value;
+    fields >> rate;
+    while (fields >> value) {
+      response.push_back(value);
+    }
+
+    if (rate == 0 or response.size() < 2 or not fields.eof()) {
+      throw std::runtime_error("Invalid passband response at " + path + ":" +
+                               std::to_string(number));
+    }
+    responses_[rate] = std::move(response);
+  }
+}
+
+const std::vector<float> *
+PassbandTables::response(const uint32_t samplerate) const {
+  const auto it = responses_.find(samplerate);
+  return it == responses_.end() ? nullptr : &it->second;
+}
+
+std::vector<float>
+PassbandTables::correction(const std::vector<float> &response) {
+  std::vector<float> result(response.size());
+  std::transform(response.begin(), response.end(), result.begin(),
+                 [](const float db) {
+                   return std::clamp(-db, -max_boost, max_boost);
+                 });
+  return result;
+}
+
+FirEqualiser::FirEqualiser(const std::vector<float> &response)
+    : taps_(2 * length), input_(2 * (length - 1)) {
+
+  const double pi = std::acos(-1.0);
+  const auto correction = PassbandTables::correction(response);
+  const size_t points = correction.size();
+
+  // Frequency sampling design: the inverse DFT of the wanted gain at the
+  // points, centred and windowed. Zero phase, so the result is only
+  // delayed.
+  for (size_t n = 0; n < length; n++) {
+    const double t = static_cast<double>(n) - static_cast<double>(delay());
+
+    std::complex<double> tap = 0;
+    for (size_t k = 0; k < points; k++) {
+      const double f =
+          (static_cast<double>(k) + 0.5) / static_cast<double>(points) - 0.5;
+      const double gain = std::pow(10.0, correction[k] / 20);
+      tap += std::polar(gain, 2 * pi * f * t);
+    }
+    tap /= static_cast<double>(points);
+
+    // Hann window
+    tap *= 0.5 + 0.5 * std::cos(2 * pi * t / (length + 1));
+
+    // Taps in time order for firCF32, h[-t] pairs with the oldest sample.
+    const size_t i = length - 1 - n;
+    taps_[2 * i] = static_cast<float>(tap.real());
+    taps_[2 * i + 1] = static_cast<float>(tap.imag());
+  }
+}
+
+const void *FirEqualiser::process(const void *src, const size_t num) {
+  const size_t history = 2 * (length - 1);
+
+  input_.resize(history + 2 * num);
+  output_.resize(2 * num);
+  std::memcpy(input_.data() + history, src, 2 * num * sizeof(float));
+
+  firCF32(input_.data(), output_.data(), num, taps_.data(), length);
+
+  // Keep the last samples for the next block
+  std::memmove(input_.data(), input_.data() + 2 * num, history * sizeof(float));
+
+  return output_.data();
+}
@@ -0,0 +1,51 @@
+// Copyright 2024 SM6WJM
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// Measured passband responses per sample rate, see the equaliser device
+// arg. A text file with one line per sample rate, comments start with #:
+// the rate followed by the response in dB at points equally spaced from
+// -rate/2 to rate/2, as returned by readSetting("passband_response").
+class PassbandTables {
+  std::map<uint32_t, std::vector<float>> responses_;
+
+public:
+  // Throws std::runtime_error if the file can't be read or parsed.
+  explicit PassbandTables(const std::string &path);
+
+  size_t size() const noexcept { return responses_.size(); }
+
+  // Response at a sample rate, nullptr if there's none.
+  const std::vector<float> *response(uint32_t samplerate) const;
+
+  // Correction in dB for a response, the inverse limited to max_boost.
+  static std::vector<float> correction(const std::vector<float> &response);
+
+  static constexpr float max_boost = 10;
+};
+
+// Short linear phase complex FIR that flattens a measured passband
+// response, see the equalise stream arg. Delays the samples by delay().
+class FirEqualiser {
+  static constexpr size_t length = 31;
+
+  // Interleaved complex taps, history followed by the block, and output.
+  std::vector<float> taps_;
+  std::vector<float> input_;
+  std::vector<float> output_;
+
+public:
+  explicit FirEqualiser(const std::vector<float> &response);
+
+  static constexpr size_t delay() noexcept { return length / 2; }
+
+  // Filter num samples, returns the result which is valid until the next
+  // call.
+  const void *process(const void *src, size_t num);
+};
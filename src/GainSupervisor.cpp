@@ -0,0 +1,118 @@
+// Copyright 2024 SM6WJM
+
+#include "GainSupervisor.hpp"
+
+#include <SoapySDR/Logger.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+// LNA gain and HF_ATT of a step.
+static double step_lna(const int step) { return step == 0 ? 6 : 0; }
+static double step_att(const int step) {
+  return step == 0 ? 0 : -6 * (step - 1);
+}
+
+static double power_db(const double power) {
+  return 10 * std::log10(std::max(power, 1e-20));
+}
+
+GainSupervisor::GainSupervisor(Apply apply, const double lna, const double att)
+    : apply_(std::move(apply)), running_(true), peakPower_(0), sumPower_(0),
+      samples_(0), clipped_(0) {
+
+  // Nearest step to the current gain
+  step_ = lna > 3 and att > -3
+              ? 0
+              : std::clamp(1 + static_cast<int>(std::lround(-att / 6)), 1,
+                           steps - 1);
+
+  thread_ = std::thread(&GainSupervisor::run, this);
+}
+
+GainSupervisor::~GainSupervisor() {
+  {
+    std::unique_lock<std::mutex> lock(lock_);
+    running_ = false;
+  }
+  wake_.notify_one();
+  thread_.join();
+}
+
+int GainSupervisor::step() const {
+  std::unique_lock<std::mutex> lock(lock_);
+  return step_;
+}
+
+void GainSupervisor::update(const BlockStats &stats) {
+  std::unique_lock<std::mutex> lock(lock_);
+  peakPower_ = std::max(peakPower_, stats.peakPower);
+  sumPower_ += stats.sumPower;
+  samples_ += stats.samples;
+  clipped_ += stats.clipped;
+}
+
+void GainSupervisor::run() {
+  std::unique_lock<std::mutex> lock(lock_);
+
+  // Periods left to ignore after a change, and periods the level has been
+  // low.
+  int settle = settle_periods;
+  int low = 0;
+
+  while (running_) {
+    wake_.wait_for(lock, period, [this] { return not running_; });
+    if (not running_) {
+      break;
+    }
+
+    // Take the statistics of this period.
+    const double peak = power_db(peakPower_);
+    const double rms =
+        power_db(samples_ > 0 ? sumPower_ / static_cast<double>(samples_) : 0);
+    const bool clipped = clipped_ > 0;
+    const bool empty = samples_ == 0;
+    peakPower_ = 0;
+    sumPower_ = 0;
+    samples_ = 0;
+    clipped_ = 0;
+
+    if (empty) {
+      continue;
+    }
+
+    if (settle > 0) {
+      settle--;
+      continue;
+    }
+
+    int next = step_;
+    if ((clipped or peak > peak_high) and step_ < steps - 1) {
+      // Step down at once
+      next = step_ + 1;
+      low = 0;
+    } else if (peak < peak_low and rms < rms_low and step_ > 0) {
+      // Step up when it has been quiet for a while
+      if (++low >= up_hold_periods) {
+        next = step_ - 1;
+        low = 0;
+      }
+    } else {
+      low = 0;
+    }
+
+    if (next != step_) {
+      SoapySDR::logf(SOAPY_SDR_DEBUG,
+                     "GainSupervisor: peak=%.1f dBFS, rms=%.1f dBFS%s, step "
+                     "%d -> %d",
+                     peak, rms, clipped ? ", clipped" : "", step_, next);
+      step_ = next;
+
+      lock.unlock();
+      apply_(step_lna(next), step_att(next));
+      lock.lock();
+
+      settle = settle_periods;
+    }
+  }
+}
@@ -0,0 +1,69 @@
+// Copyright 2024 SM6WJM
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "Converters.hpp"
+
+// Driver side gain control for unattended use. Watches the statistics of
+// every transfer and steps LNA and HF_ATT, from its own thread so the rx
+// callback never waits for a control transfer.
+//
+// The gain is a ladder of 6 dB steps, from LNA on without attenuation down
+// to LNA off with 48 dB attenuation. It steps down at once when the peak is
+// near full scale or samples clip, and up only after the peak and RMS have
+// stayed low for a while. Changes are rate limited and the samples right
+// after a change are not trusted, they may predate it.
+class GainSupervisor {
+public:
+  // Apply new LNA gain and HF_ATT, in dB as in the Gain API.
+  using Apply = std::function<void(double lna, double att)>;
+
+  // Number of steps, step 0 has the highest gain.
+  static constexpr int steps = 10;
+
+  GainSupervisor(Apply apply, double lna, double att);
+  ~GainSupervisor();
+
+  GainSupervisor(const GainSupervisor &) = delete;
+  GainSupervisor &operator=(const GainSupervisor &) = delete;
+
+  // Called from the rx callback with the statistics of each transfer.
+  void update(const BlockStats &stats);
+
+  // Current step
+  int step() const;
+
+private:
+  // Decision period, and the holds in periods.
+  static constexpr std::chrono::milliseconds period{50};
+  static constexpr int settle_periods = 2;
+  static constexpr int up_hold_periods = 20;
+
+  // Thresholds in dBFS, more than a step apart for hysteresis.
+  static constexpr double peak_high = -6;
+  static constexpr double peak_low = -20;
+  static constexpr double rms_low = -35;
+
+  Apply apply_;
+
+  mutable std::mutex lock_;
+  std::condition_variable wake_;
+  bool running_;
+  int step_;
+
+  // Accumulated since the last decision.
+  float peakPower_;
+  double sumPower_;
+  size_t samples_;
+  uint32_t clipped_;
+
+  std::thread thread_;
+
+  void run();
+};
@@ -0,0 +1,306 @@
+// Copyright 2024 SM6WJM
+
+// Block codec for complex float samples, used by the recorder (IQZ files)
+// and usable for forwarding over a network.
+//
+// Each block is coded independently:
+//  - quantise to `bits` bits, lossless below the chosen resolution
+//  - predict per channel, from nothing or from the previous sample,
+//    whichever gives the smaller residuals for this block
+//  - zigzag and Rice code the residuals with a per block parameter
+//
+// Multi byte fields are little endian, as on every platform this driver
+// runs on. No dependencies on SoapySDR or libairspyhf.
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+// File header of an IQZ recording.
+struct IqzFileHeader {
+  static constexpr uint32_t magic_value = 0x315a5149; // "IQZ1"
+
+  uint32_t magic;
+  // Quantisation in bits per component.
+  uint32_t bits;
+  double sampleRate;
+  double centerFrequency;
+};
+
+// Header of each coded block.
+struct IqzBlockHeader {
+  // Number of complex samples in the block.
+  uint32_t samples;
+  // Size of the coded payload following the header.
+  uint32_t payloadBytes;
+  // Time of the first sample.
+  int64_t timeNs;
+  // Predictor order and Rice parameter for I and Q.
+  uint8_t order[2];
+  uint8_t rice[2];
+  uint8_t reserved[4];
+};
+
+static_assert(sizeof(IqzFileHeader) == 24, "IqzFileHeader must be packed");
+static_assert(sizeof(IqzBlockHeader) == 24, "IqzBlockHeader must be packed");
+
+class IqCodec {
+  // Quotients from this value on are escaped and sent raw.
+  static constexpr uint32_t rice_escape = 24;
+  static constexpr uint32_t max_rice = 24;
+
+  // LSB first bit packer with a 64 bit accumulator.
+  class BitWriter {
+    std::vector<uint8_t> &out_;
+    uint64_t acc_ = 0;
+    unsigned count_ = 0;
+
+  public:
+    explicit BitWriter(std::vector<uint8_t> &out) : out_(out) {}
+
+    // Write up to 32 bits.
+    inline void put(const uint64_t bits, const unsigned count) {
+      acc_ |= bits << count_;
+      count_ += count;
+      if (count_ >= 32) {
+        const uint32_t word = static_cast<uint32_t>(acc_);
+        const size_t size = out_.size();
+        out_.resize(size + 4);
+        std::memcpy(out_.data() + size, &word, 4);
+        acc_ >>= 32;
+        count_ -= 32;
+      }
+    }
+
+    void flush() {
+      while (count_ > 0) {
+        out_.push_back(static_cast<uint8_t>(acc_));
+        acc_ >>= 8;
+        count_ = count_ > 8 ? count_ - 8 : 0;
+      }
+    }
+  };
+
+  class BitReader {
+    const uint8_t *pos_;
+    const uint8_t *end_;
+    uint64_t acc_ = 0;
+    unsigned count_ = 0;
+
+  public:
+    BitReader(const uint8_t *begin, const size_t size)
+        : pos_(begin), end_(begin + size) {}
+
+    inline void refill() {
+      while (count_ <= 56) {
+        const uint64_t byte = pos_ < end_ ? *pos_++ : 0;
+        acc_ |= byte << count_;
+        count_ += 8;
+      }
+    }
+
+    // Read up to 32 bits.
+    inline uint32_t get(const unsigned count) {
+      if (count == 0) {
+        return 0;
+      }
+      if (count_ < count) {
+        refill();
+      }
+      const auto bits = static_cast<uint32_t>(acc_ & ((1ull << count) - 1));
+      acc_ >>= count;
+      count_ -= count;
+      return bits;
+    }
+
+    // Count ones up to a zero or limit, the zero is consumed.
+    inline uint32_t unary(const uint32_t limit) {
+      if (count_ < limit + 1) {
+        refill();
+      }
+      const auto ones =
+          std::min<uint32_t>(static_cast<uint32_t>(__builtin_ctzll(~acc_)),
+                             limit);
+      const unsigned used = ones + (ones < limit ? 1 : 0);
+      acc_ >>= used;
+      count_ -= used;
+      return ones;
+    }
+  };
+
+  static inline uint32_t zigzag(const int32_t v) {
+    return (static_cast<uint32_t>(v) << 1) ^ static_cast<uint32_t>(v >> 31);
+  }
+
+  static inline int32_t unzigzag(const uint32_t u) {
+    return static_cast<int32_t>(u >> 1) ^ -static_cast<int32_t>(u & 1);
+  }
+
+  // Rice parameter close to log2 of the mean.
+  static uint8_t rice_parameter(const uint64_t sum, const size_t count) {
+    uint8_t k = 0;
+    while (k < max_rice and (static_cast<uint64_t>(count) << (k + 1)) <= sum) {
+      k++;
+    }
+    return k;
+  }
+
+  // Residuals of one channel, returns the predictor order and the Rice
+  // parameter.
+  static void predict(const int32_t *quantised, const size_t count,
+                      uint32_t *residuals, uint8_t &order, uint8_t &rice) {
+    uint64_t sum0 = 0;
+    uint64_t sum1 = 0;
+    int32_t previous = 0;
+    for (size_t i = 0; i < count; i++) {
+      sum0 += zigzag(quantised[i]);
+      sum1 += zigzag(quantised[i] - previous);
+      previous = quantised[i];
+    }
+
+    order = sum1 < sum0 ? 1 : 0;
+    rice = rice_parameter(order ? sum1 : sum0, count);
+
+    previous = 0;
+    for (size_t i = 0; i < count; i++) {
+      residuals[i] = zigzag(quantised[i] - (order ? previous : 0));
+      previous = quantised[i];
+    }
+  }
+
+  unsigned bits_;
+  float scale_;
+  int32_t max_;
+
+  // Scratch buffers, reused between blocks.
+  std::vector<int32_t> quantised_[2];
+  std::vector<uint32_t> residuals_;
+
+  // Bits checked before anything is shifted by them, they may come from a
+  // file.
+  static unsigned checked(const unsigned bits) {
+    if (bits < 8 or bits > 24) {
+      throw std::runtime_error("IqCodec bits must be 8 to 24: " +
+                               std::to_string(bits));
+    }
+    return bits;
+  }
+
+public:
+  // Quantise to `bits` bits per component, 8 to 24.
+  explicit IqCodec(const unsigned bits = 16)
+      : bits_(checked(bits)),
+        scale_(static_cast<float>((1 << (bits_ - 1)) - 1)),
+        max_((1 << (bits_ - 1)) - 1) {}
+
+  unsigned bits() const noexcept { return bits_; }
+
+  // Append one coded block, header and payload, to out.
+  void encode(const std::complex<float> *samples, const size_t count,
+              const int64_t timeNs, std::vector<uint8_t> &out) {
+
+    IqzBlockHeader header{};
+    header.samples = static_cast<uint32_t>(count);
+    header.timeNs = timeNs;
+
+    for (auto &q : quantised_) {
+      q.resize(count);
+    }
+    residuals_.resize(count);
+
+    // Quantise, split into channels
+    const float *in = reinterpret_cast<const float *>(samples);
+    for (size_t i = 0; i < count; i++) {
+      for (size_t c = 0; c < 2; c++) {
+        quantised_[c][i] = std::clamp(
+            static_cast<int32_t>(std::lrint(in[2 * i + c] * scale_)), -max_,
+            max_);
+      }
+    }
+
+    const size_t header_pos = out.size();
+    out.resize(header_pos + sizeof(header));
+
+    BitWriter writer(out);
+    for (size_t c = 0; c < 2; c++) {
+      predict(quantised_[c].data(), count, residuals_.data(), header.order[c],
+              header.rice[c]);
+
+      const unsigned k = header.rice[c];
+      const uint32_t mask = (1u << k) - 1;
+      for (size_t i = 0; i < count; i++) {
+        const uint32_t u = residuals_[i];
+        const uint32_t q = u >> k;
+        if (q < rice_escape) {
+          // q ones, a zero, then k low bits
+          writer.put((1ull << q) - 1, q + 1);
+          writer.put(u & mask, k);
+        } else {
+          writer.put((1ull << rice_escape) - 1, rice_escape);
+          writer.put(u, 32);
+        }
+      }
+    }
+    writer.flush();
+
+    header.payloadBytes =
+        static_cast<uint32_t>(out.size() - header_pos - sizeof(header));
+    std::memcpy(out.data() + header_pos, &header, sizeof(header));
+  }
+
+  // Samples in a block, far above the one transfer the recorder codes.
+  static constexpr uint32_t max_block_samples = 1u << 20;
+
+  // Largest payload of count samples, every residual escaped.
+  static constexpr size_t max_payload_bytes(const size_t count) {
+    return (2 * count * (rice_escape + 32) + 7) / 8;
+  }
+
+  // Throws on a header no encoder writes, before anything is allocated
+  // for it.
+  static void check(const IqzBlockHeader &header) {
+    if (header.samples > max_block_samples or
+        header.payloadBytes > max_payload_bytes(header.samples)) {
+      throw std::runtime_error(
+          "IqCodec invalid block of " + std::to_string(header.samples) +
+          " samples in " + std::to_string(header.payloadBytes) + " bytes");
+    }
+    for (const auto k : header.rice) {
+      if (k > max_rice) {
+        throw std::runtime_error("IqCodec invalid rice parameter: " +
+                                 std::to_string(k));
+      }
+    }
+  }
+
+  // Decode the payload of a block into samples, which must hold
+  // header.samples elements. Throws on a corrupt header.
+  void decode(const IqzBlockHeader &header, const uint8_t *payload,
+              std::complex<float> *samples) const {
+    check(header);
+
+    BitReader reader(payload, header.payloadBytes);
+    float *out = reinterpret_cast<float *>(samples);
+    const float inv_scale = 1.0f / scale_;
+
+    for (size_t c = 0; c < 2; c++) {
+      const unsigned k = header.rice[c];
+      int32_t previous = 0;
+      for (size_t i = 0; i < header.samples; i++) {
+        const uint32_t q = reader.unary(rice_escape);
+        const uint32_t u =
+            q < rice_escape ? (q << k) | reader.get(k) : reader.get(32);
+        const int32_t value = unzigzag(u) + (header.order[c] ? previous : 0);
+        out[2 * i + c] = static_cast<float>(value) * inv_scale;
+        previous = value;
+      }
+    }
+  }
+};
@@ -0,0 +1,131 @@
+// Copyright 2024 SM6WJM
+
+#include "Recorder.hpp"
+
+#include <SoapySDR/Formats.hpp>
+#include <SoapySDR/Logger.hpp>
+
+#include <fmt/core.h>
+
+#include <cerrno>
+#include <chrono>
+#include <complex>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+Recorder::Recorder(SoapySDR::Device *device, const std::string &path,
+                   const unsigned bits)
+    : device_(device), path_(path), file_(nullptr), codec_(bits),
+      running_(true), samples_(0), bytes_(0), encodeNs_(0), overflows_(0) {
+
+  file_ = std::fopen(path.c_str(), "wb");
+  if (file_ == nullptr) {
+    throw std::runtime_error("Could not open " + path + ": " +
+                             std::string(strerror(errno)));
+  }
+
+  IqzFileHeader header{};
+  header.magic = IqzFileHeader::magic_value;
+  header.bits = bits;
+  header.sampleRate = device_->getSampleRate(SOAPY_SDR_RX, 0);
+  header.centerFrequency = device_->getFrequency(SOAPY_SDR_RX, 0);
+
+  if (std::fwrite(&header, sizeof(header), 1, file_) != 1) {
+    std::fclose(file_);
+    throw std::runtime_error("Could not write " + path);
+  }
+
+  thread_ = std::thread(&Recorder::record, this);
+
+  SoapySDR::logf(SOAPY_SDR_INFO, "Recording to %s (%u bits)", path.c_str(),
+                 bits);
+}
+
+Recorder::~Recorder() {
+  running_ = false;
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  std::fclose(file_);
+
+  SoapySDR::logf(SOAPY_SDR_INFO, "Recording to %s stopped: %s", path_.c_str(),
+                 stats().c_str());
+}
+
+std::string Recorder::stats() const {
+  const auto samples = samples_.load();
+  const auto bytes = bytes_.load();
+  const auto encodeNs = encodeNs_.load();
+
+  // Against CF32, 8 bytes per sample
+  const double ratio = bytes > 0 ? 8.0 * static_cast<double>(samples) /
+                                       static_cast<double>(bytes)
+                                 : 0;
+  const double msps = encodeNs > 0 ? 1e3 * static_cast<double>(samples) /
+                                         static_cast<double>(encodeNs)
+                                   : 0;
+
+  return fmt::format("samples={},bytes={},ratio={:.2f},encode_msps={:.1f},"
+                     "overflows={}",
+                     samples, bytes, ratio, msps, overflows_.load());
+}
+
+void Recorder::record() {
+  const long timeout_us = 100'000;
+
+  SoapySDR::Stream *stream = nullptr;
+  try {
+    // Dropping, a slow disk must not hold back the other streams.
+    stream = device_->setupStream(SOAPY_SDR_RX, SOAPY_SDR_CF32, {0},
+                                  {{"overflow", "drop"}});
+    if (device_->activateStream(stream) != 0) {
+      throw std::runtime_error("activateStream failed");
+    }
+  } catch (const std::exception &e) {
+    SoapySDR::logf(SOAPY_SDR_ERROR, "Recorder: could not start stream: %s",
+                   e.what());
+    if (stream != nullptr) {
+      device_->closeStream(stream);
+    }
+    return;
+  }
+
+  std::vector<std::complex<float>> samples(device_->getStreamMTU(stream));
+  std::vector<uint8_t> block;
+
+  while (running_) {
+    void *buffs[] = {samples.data()};
+    int flags = 0;
+    long long timeNs = 0;
+    const int read = device_->readStream(stream, buffs, samples.size(), flags,
+                                         timeNs, timeout_us);
+    if (read == SOAPY_SDR_OVERFLOW) {
+      overflows_++;
+      continue;
+    }
+    if (read <= 0) {
+      continue;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    block.clear();
+    codec_.encode(samples.data(), static_cast<size_t>(read), timeNs, block);
+    encodeNs_ += static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start)
+            .count());
+
+    if (std::fwrite(block.data(), 1, block.size(), file_) != block.size()) {
+      SoapySDR::logf(SOAPY_SDR_ERROR, "Recorder: write to %s failed: %s",
+                     path_.c_str(), strerror(errno));
+      break;
+    }
+
+    samples_ += static_cast<uint64_t>(read);
+    bytes_ += block.size();
+  }
+
+  device_->deactivateStream(stream);
+  device_->closeStream(stream);
+}
@@ -0,0 +1,45 @@
+// Copyright 2024 SM6WJM
+
+#pragma once
+
+#include <SoapySDR/Device.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+#include "IqCodec.hpp"
+
+// Records the device to an IQZ file (see IqCodec.hpp) from its own thread
+// and stream. Started and stopped with the record setting.
+class Recorder {
+  SoapySDR::Device *device_;
+  std::string path_;
+  FILE *file_;
+  IqCodec codec_;
+
+  std::atomic<bool> running_;
+  std::thread thread_;
+
+  // Statistics
+  std::atomic<uint64_t> samples_;
+  std::atomic<uint64_t> bytes_;
+  std::atomic<uint64_t> encodeNs_;
+  std::atomic<uint64_t> overflows_;
+
+  void record();
+
+public:
+  Recorder(SoapySDR::Device *device, const std::string &path, unsigned bits);
+  ~Recorder();
+
+  Recorder(const Recorder &) = delete;
+  Recorder &operator=(const Recorder &) = delete;
+
+  const std::string &path() const { return path_; }
+
+  // Compression ratio against CF32 and encoder throughput, key=value pairs.
+  std::string stats() const;
+};
@@ -24,21 +24,73 @@
  * THE SOFTWARE.
  */
 
+#include "Aggregate.hpp"
+#include "DeviceList.hpp"
 #include "SoapyAirspyHF.hpp"
 #include <SoapySDR/Registry.hpp>
 
 #include <fmt/core.h>
 
+#include <sstream>
+
 static std::vector<SoapySDR::Kwargs>
 findAirspyHF(const SoapySDR::Kwargs &args) {
 
-  (void)args; // unused (for now)
-
   // Log debug
   SoapySDR::logf(SOAPY_SDR_DEBUG, "findAirspyHF");
 
   std::vector<SoapySDR::Kwargs> results;
 
+  // Several serials make one aggregate device, if all are attached.
+  if (args.count("serial") and
+      args.at("serial").find(SoapyAirspyHFAggregate::serial_separator) !=
+          std::string::npos) {
+    const auto serials = DeviceList::instance().serials();
+    std::stringstream list(args.at("serial"));
+    std::string part;
+    std::string found;
+    while (std::getline(list, part, SoapyAirspyHFAggregate::serial_separator)) {
+      uint64_t serial = 0;
+      try {
+        serial = std::stoull(part, nullptr, 16);
+      } catch (const std::logic_error &) {
+        SoapySDR::logf(SOAPY_SDR_DEBUG, "findAirspyHF: bad serial %s",
+                       part.c_str());
+        return results;
+      }
+      if (std::find(serials.begin(), serials.end(), serial) ==
+          serials.end()) {
+        return results;
+      }
+      if (not found.empty()) {
+        found += SoapyAirspyHFAggregate::serial_separator;
+      }
+      found += fmt::format("{:016x}", serial);
+    }
+
+    SoapySDR::Kwargs soapyInfo;
+    soapyInfo["serial"] = found;
+    soapyInfo["label"] =
+        fmt::format("AirSpy HF+ aggregate [{}]", soapyInfo["serial"]);
+    results.push_back(soapyInfo);
+    return results;
+  }
+
+  // Only this serial, if given. A bad one matches nothing, no need to ask
+  // the devices.
+  bool filter = false;
+  uint64_t wanted = 0;
+  if (args.count("serial")) {
+    try {
+      wanted = std::stoull(args.at("serial"), nullptr, 16);
+      filter = true;
+    } catch (const std::logic_error &) {
+      SoapySDR::logf(SOAPY_SDR_DEBUG, "findAirspyHF: bad serial %s",
+                     args.at("serial").c_str());
+      return results;
+    }
+  }
+
   airspyhf_lib_version_t asVersion;
   airspyhf_lib_version(&asVersion);
 
@@ -46,21 +98,19 @@ findAirspyHF(const SoapySDR::Kwargs &args) {
                  asVersion.major_version, asVersion.minor_version,
                  asVersion.revision);
 
-  uint64_t serials[MAX_DEVICES];
+  const auto serials = DeviceList::instance().serials();
 
-  const int count = airspyhf_list_devices(serials, MAX_DEVICES);
-  if (count == AIRSPYHF_ERROR) {
-    SoapySDR::logf(SOAPY_SDR_ERROR, "libairspyhf error listing devices");
-    return results;
-  }
-
-  SoapySDR::logf(SOAPY_SDR_DEBUG, "%d AirSpy boards found.", count);
+  SoapySDR::logf(SOAPY_SDR_DEBUG, "%zu AirSpy boards found.", serials.size());
 
   // Iterate over found serials
-  for (int i = 0; i < count; i++) {
+  for (const auto serial : serials) {
+    if (filter and serial != wanted) {
+      continue;
+    }
+
     SoapySDR::Kwargs soapyInfo;
 
-    soapyInfo["serial"] = fmt::format("{:016x}", serials[i]);
+    soapyInfo["serial"] = fmt::format("{:016x}", serial);
     soapyInfo["label"] = fmt::format("AirSpy HF+ [{}]", soapyInfo["serial"]);
 
     SoapySDR::logf(SOAPY_SDR_DEBUG, "Found device %s",
@@ -76,6 +126,11 @@ static SoapySDR::Device *makeAirspyHF(const SoapySDR::Kwargs &args) {
   // Log debug
   SoapySDR::logf(SOAPY_SDR_DEBUG, "makeAirspyHF");
 
+  if (args.count("serial") and
+      args.at("serial").find(SoapyAirspyHFAggregate::serial_separator) !=
+          std::string::npos) {
+    return new SoapyAirspyHFAggregate(args);
+  }
   return new SoapyAirspyHF(args);
 }
 
@@ -2,6 +2,8 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <atomic>
 #include <chrono>
 #include <condition_variable>
@@ -10,6 +12,7 @@
 #include <iostream>
 #include <mutex>
 #include <stdexcept>
+#include <utility>
 
 #include <cstddef>
 #include <cstdint>
@@ -19,22 +22,69 @@
 // The Cortex-A7 in the RPi3 has a 64-byte cache line size (L2 cache)
 #define cacheline_aligned alignas(64)
 
-template <typename T> class RingBuffer {
+// Producer positions, laid out to be usable from shared memory.
+struct RingPositions {
+  static_assert(std::atomic<uint64_t>::is_always_lock_free,
+                "Shared positions need lock free atomics");
+
+  // Total number of elements written.
+  cacheline_aligned std::atomic<uint64_t> write_pos{0};
+  // Upper bound of what the producer may be writing right now.
+  std::atomic<uint64_t> reserve_pos{0};
+};
 
+// Single producer, multiple consumer ring buffer. Each consumer registers a
+// Reader with its own read position. Blocking readers gate the producer, the
+// slowest one decides how much can be written. Dropping readers never gate
+// the producer, instead they detect when they have been overrun.
+template <typename T> class RingBuffer {
+public:
+  // Maximum number of concurrently registered readers
+  static constexpr size_t max_readers = 8;
+
+  // Returned by Reader::read_at_least()
+  static constexpr ssize_t read_timeout = -1;
+  static constexpr ssize_t read_overrun = -2;
+
+  class Reader;
+
+private:
+  // Reader state shared with the producer.
+  struct ReaderSlot {
+    cacheline_aligned std::atomic<size_t> pos{0};
+    std::atomic<bool> active{false};
+    bool blocking = true;
+
+    // Asynchronous waiter, used to signal the ready_fd of non-blocking
+    // reads, see AsyncRead.hpp. Armed by the reader, fired at most once by
+    // the producer.
+    std::atomic<bool> waiter_armed{false};
+    size_t waiter_required = 0;
+    std::function<void()> waiter;
+  };
+
+  const int mem_fd_;
   T *buffer_;
   const size_t capacity_;
 
-  cacheline_aligned std::atomic<size_t> read_pos_{0};
+  // Optional copy of the positions, e.g. in shared memory.
+  std::atomic<RingPositions *> shared_positions_{nullptr};
+
   cacheline_aligned std::atomic<size_t> write_pos_{0};
+  // Upper bound of what the producer may be writing right now. Lets
+  // dropping readers detect that what they read has been overwritten.
+  std::atomic<size_t> reserve_pos_{0};
 
-  size_t read_pos_cached_ = 0;
   size_t write_pos_cached_ = 0;
-  size_t available_cached_ = 0;
   size_t free_cached_ = 0;
 
+  std::array<ReaderSlot, max_readers> slots_;
+  cacheline_aligned std::atomic<size_t> waiters_armed_{0};
+
   // We need these because there's not timed out wait on std::atomic.
   cacheline_aligned std::mutex lock_;
-  cacheline_aligned std::condition_variable cond_;
+  std::condition_variable readable_;
+  std::condition_variable writable_;
 
   // Unmap mirror memory
   static void unmap_mirror(const void *addr, const size_t size) noexcept {
@@ -49,8 +99,8 @@ template <typename T> class RingBuffer {
     return (val != 0) && ((val & (val - 1)) == 0);
   }
 
-  // Double mapped memory for "magic" ring buffer.
-  static T *map_mirror(const size_t size) {
+  // Create the memfd backing the buffer.
+  static int create_memfd(const size_t size) {
     // Get page size
     const auto pagesize = static_cast<size_t>(getpagesize());
     if (size < pagesize) {
@@ -67,20 +117,25 @@ template <typename T> class RingBuffer {
 
     // Create a memfd. Name is only for debugging purposes and can
     // be reused.
-    int mem_fd = memfd_create("soapy_ring_buffer", 0);
+    int mem_fd = memfd_create("soapy_ring_buffer", MFD_CLOEXEC);
     if (mem_fd == -1) {
-      // TODO: add exact error
       throw std::runtime_error("Could not create memfd: " +
                                std::string(strerror(errno)));
     }
 
     // Truncate to size
-    const int ftruncate_res = ftruncate(mem_fd, size);
+    const int ftruncate_res = ftruncate(mem_fd, static_cast<off_t>(size));
     if (ftruncate_res == -1) {
+      close(mem_fd);
       throw std::runtime_error("Could not ftruncate memfd: " +
                                std::string(strerror(errno)));
     }
 
+    return mem_fd;
+  }
+
+  // Double mapped memory for "magic" ring buffer.
+  static T *map_mirror(const int mem_fd, const size_t size) {
     // Find a piece of memory of size 2 * size.
     void *buffer =
         mmap(NULL, 2 * size, PROT_NONE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
@@ -124,138 +179,378 @@ template <typename T> class RingBuffer {
     return (capacity_ - 1) & val;
   }
 
+  // Position of the slowest blocking reader, or the write position if there
+  // are none. Must only be called from producer.
+  size_t slowest_reader() const noexcept {
+    size_t max_lag = 0;
+    for (const auto &slot : slots_) {
+      if (slot.active.load(std::memory_order_acquire) and slot.blocking) {
+        max_lag = std::max(max_lag,
+                           write_pos_cached_ -
+                               slot.pos.load(std::memory_order_acquire));
+      }
+    }
+    return write_pos_cached_ - max_lag;
+  }
+
+  // Called by the producer when a waiter is armed. Takes the lock so it
+  // can't race with Reader::notify_when_available().
+  void fire_waiters() {
+    std::array<std::function<void()>, max_readers> wake;
+    {
+      std::unique_lock<std::mutex> lock(lock_);
+      const size_t write_pos = write_pos_.load(std::memory_order_acquire);
+      for (size_t i = 0; i < max_readers; i++) {
+        auto &slot = slots_[i];
+        if (not slot.waiter_armed.load(std::memory_order_relaxed) or
+            write_pos - slot.pos.load(std::memory_order_acquire) <
+                slot.waiter_required) {
+          continue;
+        }
+        slot.waiter_armed.store(false, std::memory_order_relaxed);
+        waiters_armed_.fetch_sub(1, std::memory_order_relaxed);
+        wake[i] = std::move(slot.waiter);
+        slot.waiter = nullptr;
+      }
+    }
+    // Invoke outside the lock, the callbacks may resume the readers.
+    for (auto &w : wake) {
+      if (w) {
+        w();
+      }
+    }
+  }
+
 public:
+  // A registered consumer of the ring buffer. Must only be used from one
+  // thread at a time. Releases its slot when destroyed.
+  class Reader {
+    friend class RingBuffer;
+
+    RingBuffer *ring_ = nullptr;
+    ReaderSlot *slot_ = nullptr;
+
+    size_t read_pos_cached_ = 0;
+    size_t available_cached_ = 0;
+    size_t overruns_ = 0;
+
+    Reader(RingBuffer *ring, ReaderSlot *slot)
+        : ring_(ring), slot_(slot),
+          read_pos_cached_(slot->pos.load(std::memory_order_relaxed)) {}
+
+    // Check if data at the read position could have been overwritten.
+    bool overrun() const noexcept {
+      if (slot_->blocking) {
+        return false;
+      }
+      // Pairs with the release fence in write_at_least().
+      std::atomic_thread_fence(std::memory_order_acquire);
+      return ring_->reserve_pos_.load(std::memory_order_relaxed) -
+                 read_pos_cached_ >
+             ring_->capacity_;
+    }
+
+  public:
+    Reader() = default;
+
+    Reader(Reader &&other) noexcept { *this = std::move(other); }
+
+    Reader &operator=(Reader &&other) noexcept {
+      if (this != &other) {
+        release();
+        ring_ = std::exchange(other.ring_, nullptr);
+        slot_ = std::exchange(other.slot_, nullptr);
+        read_pos_cached_ = other.read_pos_cached_;
+        available_cached_ = other.available_cached_;
+        overruns_ = other.overruns_;
+      }
+      return *this;
+    }
+
+    Reader(const Reader &) = delete;
+    Reader &operator=(const Reader &) = delete;
+
+    ~Reader() { release(); }
+
+    // Unregister from the ring buffer.
+    void release() noexcept {
+      if (slot_ == nullptr) {
+        return;
+      }
+      cancel_notify();
+      slot_->active.store(false, std::memory_order_release);
+      slot_ = nullptr;
+      // The producer might be waiting for us.
+      ring_->writable_.notify_one();
+      ring_ = nullptr;
+    }
+
+    bool valid() const noexcept { return slot_ != nullptr; }
+
+    // Number of times this reader has been overrun. Only dropping readers
+    // can be overrun.
+    size_t overruns() const noexcept { return overruns_; }
+
+    // Absolute position of the next element to read.
+    size_t position() const noexcept { return read_pos_cached_; }
+
+    // Available elements to read
+    inline size_t available(const size_t required = 0) noexcept {
+      if (available_cached_ < required) {
+        available_cached_ =
+            ring_->write_pos_.load(std::memory_order_acquire) -
+            read_pos_cached_;
+      }
+      return available_cached_;
+    }
+
+    // Pointer to read location.
+    inline const T *read_ptr() const noexcept {
+      return ring_->buffer_ + ring_->mask(read_pos_cached_);
+    }
+
+    // Indicate number of elements read.
+    inline void consume(const size_t elements) noexcept {
+      // intentional wrap around arithmetic
+      available_cached_ -= elements;
+      read_pos_cached_ += elements;
+      slot_->pos.store(read_pos_cached_, std::memory_order_release);
+      if (slot_->blocking) {
+        ring_->writable_.notify_one();
+      }
+    }
+
+    // Skip everything written so far.
+    void clear() noexcept {
+      read_pos_cached_ = ring_->write_pos_.load(std::memory_order_acquire);
+      available_cached_ = 0;
+      slot_->pos.store(read_pos_cached_, std::memory_order_release);
+      ring_->writable_.notify_one();
+    }
+
+    // Register a callback that is invoked once, from the producer thread,
+    // when at least `elements` are available to read. Returns false, without
+    // registering, if they are already available. Only one callback can be
+    // registered at a time, registering again replaces it.
+    bool notify_when_available(const size_t elements,
+                               std::function<void()> wake) {
+      std::unique_lock<std::mutex> lock(ring_->lock_);
+
+      if (slot_->waiter_armed.load(std::memory_order_relaxed)) {
+        ring_->waiters_armed_.fetch_sub(1, std::memory_order_relaxed);
+      }
+
+      slot_->waiter_required = elements;
+      slot_->waiter = std::move(wake);
+      slot_->waiter_armed.store(true, std::memory_order_relaxed);
+      // seq_cst pairs with the store in produce()
+      ring_->waiters_armed_.fetch_add(1, std::memory_order_seq_cst);
+
+      // Check again after arming, the producer might have written in
+      // between.
+      available_cached_ = ring_->write_pos_.load(std::memory_order_seq_cst) -
+                          read_pos_cached_;
+      if (available_cached_ >= elements) {
+        slot_->waiter_armed.store(false, std::memory_order_relaxed);
+        ring_->waiters_armed_.fetch_sub(1, std::memory_order_relaxed);
+        slot_->waiter = nullptr;
+        return false;
+      }
+
+      return true;
+    }
+
+    // Cancel a registered callback.
+    void cancel_notify() noexcept {
+      if (slot_ == nullptr) {
+        return;
+      }
+      std::unique_lock<std::mutex> lock(ring_->lock_);
+      if (slot_->waiter_armed.load(std::memory_order_relaxed)) {
+        slot_->waiter_armed.store(false, std::memory_order_relaxed);
+        ring_->waiters_armed_.fetch_sub(1, std::memory_order_relaxed);
+      }
+      slot_->waiter = nullptr;
+    }
+
+    // Wait for at least `elements` and pass them to callback, which returns
+    // the number of elements consumed. Returns read_timeout on timeout and
+    // read_overrun if a dropping reader was overrun, in which case the
+    // reader skips to the newest data.
+    ssize_t read_at_least(
+        const size_t elements, const std::chrono::microseconds &timeout,
+        const std::function<size_t(const T *begin, const size_t avail)>
+            callback) {
+
+      auto avail = available(elements);
+
+      if (avail < elements) {
+        // Wait for more elements
+        std::unique_lock<std::mutex> lock(ring_->lock_);
+        if (not ring_->readable_.wait_for(lock, timeout, [&] {
+              avail = available(elements);
+              return avail >= elements;
+            })) {
+          // We timed out
+          return read_timeout;
+        }
+      }
+
+      if (overrun()) {
+        overruns_++;
+        clear();
+        return read_overrun;
+      }
+
+      // Dropping readers can lag more than the capacity.
+      avail = std::min(avail, ring_->capacity_);
+
+      const auto consumed = callback(read_ptr(), avail);
+
+      // The producer might have overwritten what we just read.
+      if (overrun()) {
+        overruns_++;
+        clear();
+        return read_overrun;
+      }
+
+      consume(consumed);
+      return static_cast<ssize_t>(consumed);
+    }
+  };
+
   // Size in bytes, is a power of two.
   size_t size() const noexcept { return capacity_ * sizeof(T); }
 
   // Capacity in elements
   inline size_t capacity() const noexcept { return capacity_; }
 
+  // File descriptor of the memory backing the buffer, map it twice to get
+  // the mirrored view.
+  int fd() const noexcept { return mem_fd_; }
+
+  // Publish positions to `positions` as well, nullptr to stop.
+  void share_positions(RingPositions *positions) noexcept {
+    if (positions != nullptr) {
+      positions->reserve_pos.store(
+          reserve_pos_.load(std::memory_order_relaxed),
+          std::memory_order_relaxed);
+      positions->write_pos.store(write_pos_.load(std::memory_order_acquire),
+                                 std::memory_order_release);
+    }
+    shared_positions_.store(positions, std::memory_order_release);
+  }
+
+  // Total number of elements written.
+  size_t write_position() const noexcept {
+    return write_pos_.load(std::memory_order_acquire);
+  }
+
+  // Register a new reader starting at the current write position. Blocking
+  // readers gate the producer, dropping readers are overrun if they are too
+  // slow.
+  Reader add_reader(const bool blocking = true) {
+    std::unique_lock<std::mutex> lock(lock_);
+    for (auto &slot : slots_) {
+      if (not slot.active.load(std::memory_order_relaxed)) {
+        slot.blocking = blocking;
+        slot.pos.store(write_pos_.load(std::memory_order_acquire),
+                       std::memory_order_relaxed);
+        slot.active.store(true, std::memory_order_release);
+        return Reader(this, &slot);
+      }
+    }
+
+    throw std::runtime_error("Too many ring buffer readers, max: " +
+                             std::to_string(max_readers));
+  }
+
   // Indicate number of elements written. Must only be called from
   // producer.
   inline void produce(const size_t elements) noexcept {
     // intentional wrap around arithmetic
     free_cached_ -= elements;
     write_pos_cached_ += elements;
-    write_pos_.fetch_add(elements, std::memory_order_release);
-    cond_.notify_one();
-  }
+    if (reserve_pos_.load(std::memory_order_relaxed) - write_pos_cached_ >
+        capacity_) {
+      // Produced more than reserved.
+      reserve_pos_.store(write_pos_cached_, std::memory_order_relaxed);
+    }
+    // seq_cst pairs with Reader::notify_when_available()
+    write_pos_.store(write_pos_cached_, std::memory_order_seq_cst);
 
-  // Indicate number of elements read. Must only be called from
-  // consumer.
-  inline void consume(const size_t elements) noexcept {
-    // intentional wrap around arithmetic
-    available_cached_ -= elements;
-    read_pos_cached_ += elements;
-    read_pos_.fetch_add(elements, std::memory_order_release);
-    cond_.notify_one();
-  }
+    if (auto *shared = shared_positions_.load(std::memory_order_acquire)) {
+      shared->write_pos.store(write_pos_cached_, std::memory_order_release);
+    }
+    readable_.notify_all();
 
-  // Available elements to read
-  inline size_t available(const size_t required = 0) noexcept {
-    if (available_cached_ < required) {
-      available_cached_ =
-          write_pos_.load(std::memory_order_acquire) - read_pos_cached_;
+    if (waiters_armed_.load(std::memory_order_seq_cst) != 0) {
+      fire_waiters();
     }
-    return available_cached_;
   }
 
   // Available space to write
   inline size_t free_to_write(const size_t required = 0) noexcept {
     if (free_cached_ < required) {
-      free_cached_ = capacity_ - (write_pos_cached_ -
-                                  read_pos_.load(std::memory_order_acquire));
+      free_cached_ = capacity_ - (write_pos_cached_ - slowest_reader());
     }
     return free_cached_;
   }
 
-  // Pointer to read location. Must only be called from consumer.
-  inline const T *read_ptr() const noexcept {
-    return buffer_ + mask(read_pos_cached_);
-  }
-
   // Pointer to write location. Must only be called from producer.
   inline T *write_ptr() const noexcept {
     return buffer_ + mask(write_pos_cached_);
   }
 
-  // Rest buffer
-  void clear() noexcept {
-    std::unique_lock<std::mutex> lock(lock_);
-    available_cached_ = 0;
-    free_cached_ = capacity_;
-    read_pos_cached_ = 0;
-    write_pos_cached_ = 0;
-    read_pos_.store(0, std::memory_order_release);
-    write_pos_.store(0, std::memory_order_release);
-
-    // Wake up producer and consumer.
-    cond_.notify_all();
-  }
-
-  ssize_t
-  read_at_least(const size_t elements, const std::chrono::microseconds &timeout,
-                const std::function<size_t(const T *begin, const size_t avail)>
-                    callback) {
-
-    auto avail = available(elements);
-
-    if (avail >= elements) {
-      // We have enough elements, no need to wait
-      const auto consumed = callback(read_ptr(), avail);
-      consume(consumed);
-      return consumed;
-    }
-
-    // Else wait for more elements
-    std::unique_lock<std::mutex> lock(lock_);
-    // Wait for enough data to be available
-    if (cond_.wait_for(lock, timeout, [&] {
-          avail = available(elements);
-          return avail >= elements;
-        })) {
-      // Ok, we have enough data
-      const auto consumed = callback(read_ptr(), avail);
-      consume(consumed);
-      return consumed;
-    } else {
-      // We timed out
-      return -1;
-    }
-  }
-
+  // Wait for space for at least `elements` and pass it to callback, which
+  // returns the number of elements produced. With dropping readers the
+  // callback should not produce more than `elements`. Returns -1 on
+  // timeout.
   ssize_t write_at_least(
       const size_t elements, const std::chrono::microseconds &timeout,
       const std::function<size_t(T *begin, const size_t free)> callback) {
 
     auto free = free_to_write(elements);
 
-    if (free >= elements) {
-      // Ok, we have enough space, not need to wait
-      const auto produced = callback(write_ptr(), free);
-      produce(produced);
-      return produced;
+    if (free < elements) {
+      // Wait for enough space to be available
+      std::unique_lock<std::mutex> lock(lock_);
+      if (not writable_.wait_for(lock, timeout, [&] {
+            free = free_to_write(elements);
+            return free >= elements;
+          })) {
+        // We timed out
+        return -1;
+      }
+      // Drop the lock before producing, produce() may need it to fire the
+      // async waiters.
     }
 
-    // Else wait for enough space to be available
-    std::unique_lock<std::mutex> lock(lock_);
-    // Wait for enough data to be available
-    if (cond_.wait_for(lock, timeout, [&] {
-          free = free_to_write(elements);
-          return free >= elements;
-        })) {
-      // Ok, we have enough data
-      const auto produced = callback(write_ptr(), free);
-      produce(produced);
-      return produced;
-    } else {
-      // We timed out
-      return -1;
+    // Announce what we are about to overwrite before writing, pairs with
+    // the acquire fence in Reader::overrun().
+    reserve_pos_.store(write_pos_cached_ + elements,
+                       std::memory_order_relaxed);
+    if (auto *shared = shared_positions_.load(std::memory_order_acquire)) {
+      shared->reserve_pos.store(write_pos_cached_ + elements,
+                                std::memory_order_relaxed);
     }
+    std::atomic_thread_fence(std::memory_order_release);
+
+    const auto produced = callback(write_ptr(), free);
+    produce(produced);
+    return static_cast<ssize_t>(produced);
   }
 
   explicit RingBuffer(size_t capacity)
-      : buffer_(map_mirror(capacity * sizeof(T))), capacity_(capacity) {}
+      : mem_fd_(create_memfd(capacity * sizeof(T))),
+        buffer_(map_mirror(mem_fd_, capacity * sizeof(T))),
+        capacity_(capacity), free_cached_(capacity) {}
+
+  RingBuffer(const RingBuffer &) = delete;
+  RingBuffer &operator=(const RingBuffer &) = delete;
 
-  virtual ~RingBuffer() { unmap_mirror(buffer_, capacity_ * sizeof(T)); };
+  virtual ~RingBuffer() {
+    unmap_mirror(buffer_, capacity_ * sizeof(T));
+    close(mem_fd_);
+  };
 };
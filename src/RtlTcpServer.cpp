@@ -0,0 +1,377 @@
+// Copyright 2024 SM6WJM
+
+#include "RtlTcpServer.hpp"
+
+#include <SoapySDR/Formats.hpp>
+#include <SoapySDR/Logger.hpp>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+// rtl_tcp commands, see rtl_tcp.c in librtlsdr.
+#define RTLTCP_SET_FREQ 0x01
+#define RTLTCP_SET_SAMPLE_RATE 0x02
+#define RTLTCP_SET_GAIN_MODE 0x03
+#define RTLTCP_SET_GAIN 0x04
+#define RTLTCP_SET_FREQ_CORRECTION 0x05
+#define RTLTCP_SET_AGC_MODE 0x08
+#define RTLTCP_SET_GAIN_BY_INDEX 0x0d
+
+// Gain table reported to clients, overall gain in 6 dB steps.
+static const double gain_min_db = -48;
+static const double gain_step_db = 6;
+static const uint32_t gain_count = 10;
+
+// Limit of converted but unsent data per client, older data is dropped.
+static const size_t max_pending_bytes = 4 * 1024 * 1024;
+// Max blocks per writev.
+static const int max_iov = 64;
+
+RtlTcpServer::RtlTcpServer(SoapySDR::Device *device,
+                           const std::string &address)
+    : device_(device), listen_fd_(-1), running_(true), stream_(nullptr) {
+
+  // Parse host:port
+  std::string host = address;
+  uint16_t port = 1234;
+  const auto colon = address.rfind(':');
+  if (colon != std::string::npos) {
+    host = address.substr(0, colon);
+    try {
+      port = static_cast<uint16_t>(std::stoul(address.substr(colon + 1)));
+    } catch (const std::exception &) {
+      throw std::runtime_error("rtltcp invalid port: " + address);
+    }
+  }
+
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (inet_pton(AF_INET, host.empty() ? "127.0.0.1" : host.c_str(),
+                &addr.sin_addr) != 1) {
+    throw std::runtime_error("rtltcp invalid address: " + address);
+  }
+
+  listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  const int one = 1;
+  if (listen_fd_ == -1 or
+      setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) ==
+          -1 or
+      bind(listen_fd_, reinterpret_cast<const sockaddr *>(&addr),
+           sizeof(addr)) == -1 or
+      listen(listen_fd_, 8) == -1) {
+    const std::string error = strerror(errno);
+    if (listen_fd_ != -1) {
+      close(listen_fd_);
+    }
+    throw std::runtime_error("rtltcp could not listen on " + address + ": " +
+                             error);
+  }
+
+  thread_ = std::thread(&RtlTcpServer::serve, this);
+
+  SoapySDR::logf(SOAPY_SDR_INFO, "rtl_tcp server listening on %s:%u",
+                 host.c_str(), port);
+}
+
+RtlTcpServer::~RtlTcpServer() {
+  running_ = false;
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+
+  while (not clients_.empty()) {
+    disconnect(clients_.size() - 1);
+  }
+
+  close(listen_fd_);
+}
+
+void RtlTcpServer::accept_client() {
+  const int fd =
+      accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+  if (fd == -1) {
+    return;
+  }
+
+  const int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  // Dongle info: magic, tuner type (unknown) and gain count.
+  uint8_t header[12] = {'R', 'T', 'L', '0'};
+  const uint32_t tuner = htonl(0);
+  const uint32_t gains = htonl(gain_count);
+  std::memcpy(header + 4, &tuner, sizeof(tuner));
+  std::memcpy(header + 8, &gains, sizeof(gains));
+
+  if (send(fd, header, sizeof(header), MSG_NOSIGNAL) != sizeof(header)) {
+    close(fd);
+    return;
+  }
+
+  // First client starts the stream.
+  if (stream_ == nullptr) {
+    try {
+      stream_ = device_->setupStream(SOAPY_SDR_RX, SOAPY_SDR_CF32, {0},
+                                     {{"overflow", "drop"}});
+      samples_.resize(device_->getStreamMTU(stream_));
+      if (device_->activateStream(stream_) != 0) {
+        throw std::runtime_error("activateStream failed");
+      }
+    } catch (const std::exception &e) {
+      SoapySDR::logf(SOAPY_SDR_ERROR, "rtl_tcp: could not start stream: %s",
+                     e.what());
+      if (stream_ != nullptr) {
+        device_->closeStream(stream_);
+        stream_ = nullptr;
+      }
+      close(fd);
+      return;
+    }
+  }
+
+  Client client;
+  client.fd = fd;
+  clients_.push_back(std::move(client));
+
+  SoapySDR::logf(SOAPY_SDR_INFO, "rtl_tcp: client connected (%d clients)",
+                 static_cast<int>(clients_.size()));
+}
+
+void RtlTcpServer::disconnect(const size_t index) {
+  close(clients_[index].fd);
+  if (clients_[index].dropped > 0) {
+    SoapySDR::logf(SOAPY_SDR_INFO, "rtl_tcp: client dropped %zu bytes",
+                   clients_[index].dropped);
+  }
+  clients_.erase(clients_.begin() + static_cast<std::ptrdiff_t>(index));
+
+  SoapySDR::logf(SOAPY_SDR_INFO, "rtl_tcp: client disconnected (%d clients)",
+                 static_cast<int>(clients_.size()));
+
+  // Last client stops the stream.
+  if (clients_.empty() and stream_ != nullptr) {
+    device_->deactivateStream(stream_);
+    device_->closeStream(stream_);
+    stream_ = nullptr;
+  }
+}
+
+void RtlTcpServer::command(Client &client, const uint8_t cmd,
+                           const uint32_t param) {
+
+  SoapySDR::logf(SOAPY_SDR_DEBUG, "rtl_tcp: command 0x%02x %u", cmd, param);
+
+  switch (cmd) {
+  case RTLTCP_SET_FREQ:
+    device_->setFrequency(SOAPY_SDR_RX, 0, param);
+    break;
+  case RTLTCP_SET_SAMPLE_RATE: {
+    // The device rate is shared, the client gets the closest integer
+    // decimation of it.
+    const double rate = device_->getSampleRate(SOAPY_SDR_RX, 0);
+    client.decimation = std::max<size_t>(
+        1, static_cast<size_t>(std::lround(rate / std::max(1u, param))));
+    client.phase = 0;
+    client.acc = 0;
+    SoapySDR::logf(SOAPY_SDR_INFO, "rtl_tcp: client rate %f (decimation %zu)",
+                   rate / static_cast<double>(client.decimation),
+                   client.decimation);
+    break;
+  }
+  case RTLTCP_SET_GAIN_MODE:
+    // 0 is automatic
+    device_->setGainMode(SOAPY_SDR_RX, 0, param == 0);
+    break;
+  case RTLTCP_SET_AGC_MODE:
+    device_->setGainMode(SOAPY_SDR_RX, 0, param != 0);
+    break;
+  case RTLTCP_SET_GAIN:
+    // Tenths of dB
+    device_->setGain(SOAPY_SDR_RX, 0, static_cast<int32_t>(param) / 10.0);
+    break;
+  case RTLTCP_SET_GAIN_BY_INDEX:
+    // Indices 0 to gain_count - 1
+    device_->setGain(SOAPY_SDR_RX, 0,
+                     gain_min_db +
+                         gain_step_db * std::min(param, gain_count - 1));
+    break;
+  case RTLTCP_SET_FREQ_CORRECTION:
+    device_->setFrequencyCorrection(SOAPY_SDR_RX, 0,
+                                    static_cast<int32_t>(param));
+    break;
+  default:
+    SoapySDR::logf(SOAPY_SDR_DEBUG, "rtl_tcp: command 0x%02x not supported",
+                   cmd);
+  }
+}
+
+bool RtlTcpServer::read_commands(Client &client) {
+  while (true) {
+    const auto received = recv(client.fd, client.command + client.commandLen,
+                               sizeof(client.command) - client.commandLen, 0);
+    if (received == 0) {
+      return false; // Closed
+    }
+    if (received < 0) {
+      return errno == EAGAIN or errno == EWOULDBLOCK or errno == EINTR;
+    }
+
+    client.commandLen += static_cast<size_t>(received);
+    if (client.commandLen == sizeof(client.command)) {
+      uint32_t param;
+      std::memcpy(&param, client.command + 1, sizeof(param));
+      command(client, client.command[0], ntohl(param));
+      client.commandLen = 0;
+    }
+  }
+}
+
+void RtlTcpServer::convert(Client &client, const std::complex<float> *samples,
+                           const size_t count) {
+
+  std::vector<uint8_t> block;
+  block.reserve(2 * (count / client.decimation + 1));
+
+  const auto to_u8 = [](const float value) {
+    return static_cast<uint8_t>(
+        std::clamp(std::lround(value * 127.5f + 127.5f), 0l, 255l));
+  };
+
+  const float scale = 1.0f / static_cast<float>(client.decimation);
+
+  for (size_t i = 0; i < count; i++) {
+    // Boxcar decimation, good enough for a waterfall or a narrow band
+    // demodulator.
+    client.acc += samples[i];
+    if (++client.phase == client.decimation) {
+      block.push_back(to_u8(client.acc.real() * scale));
+      block.push_back(to_u8(client.acc.imag() * scale));
+      client.acc = 0;
+      client.phase = 0;
+    }
+  }
+
+  if (block.empty()) {
+    return;
+  }
+
+  client.pendingBytes += block.size();
+  client.pending.push_back(std::move(block));
+
+  // Slow client, drop the oldest data.
+  while (client.pendingBytes > max_pending_bytes and
+         client.pending.size() > 1) {
+    const auto size = client.pending.front().size() - client.pendingOffset;
+    client.pendingBytes -= size;
+    client.dropped += size;
+    client.pending.pop_front();
+    client.pendingOffset = 0;
+  }
+}
+
+bool RtlTcpServer::send_pending(Client &client) {
+  while (not client.pending.empty()) {
+    // Batch as many blocks as we can in one call.
+    iovec iov[max_iov];
+    int count = 0;
+    for (auto it = client.pending.begin();
+         it != client.pending.end() and count < max_iov; ++it, ++count) {
+      const size_t offset = (count == 0) ? client.pendingOffset : 0;
+      iov[count].iov_base = it->data() + offset;
+      iov[count].iov_len = it->size() - offset;
+    }
+
+    msghdr msg{};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = static_cast<size_t>(count);
+    const auto sent = sendmsg(client.fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (sent < 0) {
+      return errno == EAGAIN or errno == EWOULDBLOCK or errno == EINTR;
+    }
+
+    // Pop what was sent
+    auto remaining = static_cast<size_t>(sent);
+    client.pendingBytes -= remaining;
+    while (remaining > 0) {
+      const auto front = client.pending.front().size() - client.pendingOffset;
+      if (remaining < front) {
+        client.pendingOffset += remaining;
+        return true; // Socket buffer full
+      }
+      remaining -= front;
+      client.pending.pop_front();
+      client.pendingOffset = 0;
+    }
+  }
+
+  return true;
+}
+
+void RtlTcpServer::serve() {
+  // Poll so we notice when we are stopped.
+  const int idle_timeout_ms = 200;
+  const long read_timeout_us = 100'000;
+
+  std::vector<pollfd> pfds;
+
+  while (running_) {
+    pfds.clear();
+    pfds.push_back({listen_fd_, POLLIN, 0});
+    for (const auto &client : clients_) {
+      pfds.push_back({client.fd, POLLIN, 0});
+    }
+
+    // When streaming readStream does the waiting.
+    if (poll(pfds.data(), pfds.size(),
+             clients_.empty() ? idle_timeout_ms : 0) < 0) {
+      continue;
+    }
+
+    // Commands, from the back so we can disconnect.
+    for (size_t i = clients_.size(); i-- > 0;) {
+      if ((pfds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)) and
+          not read_commands(clients_[i])) {
+        disconnect(i);
+      }
+    }
+
+    if (pfds[0].revents & POLLIN) {
+      accept_client();
+    }
+
+    if (clients_.empty()) {
+      continue;
+    }
+
+    void *buffs[] = {samples_.data()};
+    int flags = 0;
+    long long timeNs = 0;
+    const int read = device_->readStream(stream_, buffs, samples_.size(),
+                                         flags, timeNs, read_timeout_us);
+
+    if (read > 0) {
+      for (auto &client : clients_) {
+        convert(client, samples_.data(), static_cast<size_t>(read));
+      }
+    }
+
+    for (size_t i = clients_.size(); i-- > 0;) {
+      if (not send_pending(clients_[i])) {
+        disconnect(i);
+      }
+    }
+  }
+}
@@ -0,0 +1,63 @@
+// Copyright 2024 SM6WJM
+
+#pragma once
+
+#include <SoapySDR/Device.hpp>
+
+#include <atomic>
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Serves the device to local rtl_tcp clients, enabled with the rtltcp
+// device arg. All clients share one stream, each client gets its own
+// conversion to CU8 and decimation (from the sample rate command). Slow
+// clients lose samples without affecting the others.
+class RtlTcpServer {
+  struct Client {
+    int fd;
+    // Decimation factor and boxcar accumulator state.
+    size_t decimation = 1;
+    size_t phase = 0;
+    std::complex<float> acc = 0;
+    // Converted samples waiting to be sent, front() partially sent.
+    std::deque<std::vector<uint8_t>> pending;
+    size_t pendingOffset = 0;
+    size_t pendingBytes = 0;
+    size_t dropped = 0;
+    // Partially received command.
+    uint8_t command[5];
+    size_t commandLen = 0;
+  };
+
+  SoapySDR::Device *device_;
+  int listen_fd_;
+
+  std::atomic<bool> running_;
+  std::thread thread_;
+
+  SoapySDR::Stream *stream_;
+  std::vector<std::complex<float>> samples_;
+  std::vector<Client> clients_;
+
+  void serve();
+  void accept_client();
+  bool read_commands(Client &client);
+  void command(Client &client, uint8_t cmd, uint32_t param);
+  void convert(Client &client, const std::complex<float> *samples,
+               size_t count);
+  bool send_pending(Client &client);
+  void disconnect(size_t index);
+
+public:
+  // Listen on address, "host:port" or "host" for the default port 1234.
+  RtlTcpServer(SoapySDR::Device *device, const std::string &address);
+  ~RtlTcpServer();
+
+  RtlTcpServer(const RtlTcpServer &) = delete;
+  RtlTcpServer &operator=(const RtlTcpServer &) = delete;
+};
@@ -0,0 +1,72 @@
+// Copyright 2024 SM6WJM
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// Sequence lock around a small trivially copyable value. Readers never
+// block and never block the writer, they retry if a write happened while
+// they were reading. One writer at a time, serialise writers externally.
+//
+// The value is kept in atomic words so that racing reads are well defined
+// (and quiet under TSAN), the sequence number tells whether a read was
+// torn. The words are written with release and read with acquire rather
+// than with fences, which TSAN doesn't model, so tests/seqlock_stress
+// checks the ordering too. On x86 the code is the same.
+template <typename T> class SeqLock {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "SeqLock value must be trivially copyable");
+
+  static constexpr size_t words = (sizeof(T) + 7) / 8;
+
+  std::atomic<uint64_t> sequence_;
+  std::array<std::atomic<uint64_t>, words> data_;
+
+public:
+  explicit SeqLock(const T &value = T{}) : sequence_(0) {
+    for (auto &word : data_) {
+      word.store(0, std::memory_order_relaxed);
+    }
+    store(value);
+  }
+
+  SeqLock(const SeqLock &) = delete;
+  SeqLock &operator=(const SeqLock &) = delete;
+
+  void store(const T &value) noexcept {
+    uint64_t buffer[words] = {};
+    std::memcpy(buffer, &value, sizeof(T));
+
+    // Odd while writing, a reader that sees any new word sees that too.
+    const auto sequence = sequence_.load(std::memory_order_relaxed);
+    sequence_.store(sequence + 1, std::memory_order_relaxed);
+
+    for (size_t i = 0; i < words; i++) {
+      data_[i].store(buffer[i], std::memory_order_release);
+    }
+
+    sequence_.store(sequence + 2, std::memory_order_release);
+  }
+
+  T load() const noexcept {
+    uint64_t buffer[words];
+    uint64_t before;
+    uint64_t after;
+
+    do {
+      before = sequence_.load(std::memory_order_acquire);
+      for (size_t i = 0; i < words; i++) {
+        buffer[i] = data_[i].load(std::memory_order_acquire);
+      }
+      after = sequence_.load(std::memory_order_relaxed);
+    } while (before != after or (before & 1) != 0);
+
+    T value;
+    std::memcpy(&value, buffer, sizeof(T));
+    return value;
+  }
+};
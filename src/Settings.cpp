@@ -24,16 +24,63 @@
  * THE SOFTWARE.
  */
 
+#include "DeviceList.hpp"
 #include "SoapyAirspyHF.hpp"
 #include <SoapySDR/Logger.h>
 #include <airspyhf.h>
 #include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+// Read what the device supports, the getters serve it from memory.
+static DeviceCapabilities queryCapabilities(airspyhf_device_t *device) {
+  DeviceCapabilities capabilities;
+
+  uint32_t numRates = 0;
+  int ret = airspyhf_get_samplerates(device, &numRates, 0);
+  if (ret != AIRSPYHF_SUCCESS) {
+    SoapySDR::logf(SOAPY_SDR_ERROR, "airspyhf_get_samplerates() failed: %d",
+                   ret);
+  }
+  std::vector<uint32_t> rates(numRates, 0);
+  ret = airspyhf_get_samplerates(device, rates.data(), numRates);
+  if (ret != AIRSPYHF_SUCCESS) {
+    SoapySDR::logf(SOAPY_SDR_ERROR, "airspyhf_get_samplerates() failed: %d",
+                   ret);
+    rates.clear();
+  }
+  std::sort(rates.begin(), rates.end());
+
+  for (const auto rate : rates) {
+    capabilities.sampleRates.push_back(rate);
+    // TODO: this is just an estimate.
+    capabilities.bandwidths.push_back(0.9 * rate);
+  }
+
+  capabilities.frequencyRanges = {
+      SoapySDR::Range(9'000, 31'000'000),       // 9kHz to 31MHz
+      SoapySDR::Range(60'000'000, 260'000'000), // 60MHz to 260MHz
+  };
+
+  ret = airspyhf_get_calibration(device, &capabilities.calibration);
+  if (ret != AIRSPYHF_SUCCESS) {
+    SoapySDR::logf(SOAPY_SDR_WARNING, "airspyhf_get_calibration() failed: %d",
+                   ret);
+  }
+
+  return capabilities;
+}
 
 // Driver constructor
 SoapyAirspyHF::SoapyAirspyHF(const SoapySDR::Kwargs &args)
-    : serial_(0), device_(nullptr), sampleRate_(0), centerFrequency_(0),
-      enableDSP_(true), agcEnabled_(true), lnaGain_(0), hfAttenuation_(0),
-      frequencyCorrection_(0), iqBalance_(0) {
+    : serial_(0), device_(nullptr), awaitingTransfer_(false),
+      firstTransferMs_(-1), tunedFrequency_(0), ringbuffer_(8 * 2048),
+      tickOffset_(0), hostOffsetNs_(std::numeric_limits<long long>::max()),
+      recordBits_(16), activeStreams_(0), started_(false), softPause_(false),
+      paused_(false), clippedTotal_(0), fullScaleDbm_(0) {
 
   // To enable debug logging set the environment variable
   // SOAPY_SDR_LOG_LEVEL to 7. For example:
@@ -41,6 +88,15 @@ SoapyAirspyHF::SoapyAirspyHF(const SoapySDR::Kwargs &args)
 
   int ret = 0;
 
+  // Time each phase, see the startup setting.
+  auto mark = std::chrono::steady_clock::now();
+  const auto phase = [this, &mark](const char *name) {
+    const auto now = std::chrono::steady_clock::now();
+    startup_.emplace_back(
+        name, std::chrono::duration<double, std::milli>(now - mark).count());
+    mark = now;
+  };
+
   if (args.count("serial")) {
     // For storing serial as hex
     std::stringstream serialstr;
@@ -61,6 +117,8 @@ SoapyAirspyHF::SoapyAirspyHF(const SoapySDR::Kwargs &args)
     ret = airspyhf_open_sn(&device_, serial_);
     if (ret != AIRSPYHF_SUCCESS) {
       SoapySDR::logf(SOAPY_SDR_ERROR, "airspyhf_open_sn() failed: (%d)", ret);
+      // Maybe unplugged since it was listed
+      DeviceList::instance().invalidate();
       throw std::runtime_error("Unable to open AirspyHF device with S/N " +
                                serialstr.str());
     }
@@ -71,48 +129,159 @@ SoapyAirspyHF::SoapyAirspyHF(const SoapySDR::Kwargs &args)
     // No serial, open first device
     ret = airspyhf_open(&device_);
     if (ret != AIRSPYHF_SUCCESS) {
+      DeviceList::instance().invalidate();
       throw std::runtime_error("Unable to open AirspyHF device");
     }
-  }
 
-  // TODO: move to some init function
-  std::uint32_t num_rates = 0;
-  ret = airspyhf_get_samplerates(device_, &num_rates, 0);
-  if (ret != AIRSPYHF_SUCCESS) {
-    SoapySDR::logf(SOAPY_SDR_ERROR, "airspyhf_get_samplerates() failed: (%d)",
-                   ret);
+    // Which one it was, recover() reopens by serial.
+    airspyhf_read_partid_serialno_t partid = {};
+    ret = airspyhf_board_partid_serialno_read(device_, &partid);
+    if (ret != AIRSPYHF_SUCCESS) {
+      SoapySDR::logf(SOAPY_SDR_WARNING,
+                     "airspyhf_board_partid_serialno_read() failed: %d", ret);
+    } else {
+      serial_ = static_cast<uint64_t>(partid.serial_no[0]) << 32 |
+                partid.serial_no[1];
+      SoapySDR::logf(SOAPY_SDR_INFO, "Found AirspyHF device: serial =  %llx",
+                     static_cast<unsigned long long>(serial_));
+    }
   }
-  std::vector<uint32_t> rates(num_rates, 0);
-  ret = airspyhf_get_samplerates(device_, rates.data(), num_rates);
-  if (ret != AIRSPYHF_SUCCESS) {
-    SoapySDR::logf(SOAPY_SDR_ERROR, "airspyhf_get_samplerates() failed: (%d)",
-                   ret);
+
+  phase("open");
+
+  // Close the device again if anything below throws, the destructor
+  // doesn't run then.
+  try {
+    capabilities_ = queryCapabilities(device_);
+    if (capabilities_.sampleRates.empty()) {
+      throw std::runtime_error("No sample rates from AirspyHF device");
+    }
+    updateState([this](DeviceState &state) {
+      state.frequencyCorrection = capabilities_.calibration;
+    });
+
+    phase("capabilities");
+
+    // Reference for the dBm sensors, nominal unless calibrated.
+    if (args.count("full_scale_dbm")) {
+      fullScaleDbm_ = std::stod(args.at("full_scale_dbm"));
+    }
+
+    // Per frequency calibration, applied on every setFrequency.
+    if (args.count("calibration")) {
+      calibration_ = std::make_unique<Calibration>(args.at("calibration"));
+      SoapySDR::logf(SOAPY_SDR_INFO, "Loaded %zu calibration points from %s",
+                     calibration_->size(), args.at("calibration").c_str());
+    }
+
+    // Measured settling times, before any change uses them.
+    if (args.count("settling")) {
+      settling_.table(Settling::Table::load(args.at("settling")));
+      SoapySDR::logf(SOAPY_SDR_INFO, "Loaded settling times from %s",
+                     args.at("settling").c_str());
+    }
+
+    // Initial configuration from the device args, in one pass and before
+    // the control thread so it's in place when the constructor returns.
+    // The lowest sample rate unless given, libairspyhf opens with DSP on.
+    SoapySDR::Kwargs initial;
+    for (const auto *key :
+         {"freq", "rate", "lna", "att", "agc", "ppm", "dsp"}) {
+      if (args.count(key)) {
+        initial[key] = args.at(key);
+      }
+    }
+    if (not initial.count("rate")) {
+      initial["rate"] = std::to_string(
+          static_cast<uint32_t>(capabilities_.sampleRates.front()));
+    }
+    applySettings(initial);
+    phase("configure");
+
+    // Keep the device running between streams.
+    softPause_ = args.count("soft_pause") and args.at("soft_pause") == "true";
+
+    // Reopen the device when transfers stop, unless disabled with 0.
+    const long watchdogMs =
+        args.count("watchdog") ? std::stol(args.at("watchdog")) : 1000;
+    if (watchdogMs > 0) {
+      watchdog_ = std::make_unique<Watchdog>(
+          std::chrono::milliseconds(watchdogMs),
+          [this](const Watchdog::Clock::duration gap) { return recover(gap); });
+    }
+
+    // Control transfers from their own thread, unless disabled.
+    if (not args.count("async_control") or
+        args.at("async_control") != "false") {
+      controlQueue_ = std::make_unique<ControlQueue>();
+    }
+
+    // Passband responses for the equalise stream arg.
+    if (args.count("equaliser")) {
+      passband_ = std::make_unique<PassbandTables>(args.at("equaliser"));
+      SoapySDR::logf(SOAPY_SDR_INFO, "Loaded %zu passband responses from %s",
+                     passband_->size(), args.at("equaliser").c_str());
+    }
+
+    // Share the ring buffer with other local processes.
+    if (args.count("export")) {
+      export_ = std::make_unique<SharedExport>(
+          args.at("export"), ringbuffer_.fd(), ringbuffer_.capacity(),
+          sizeof(airspyhf_complex_float_t));
+      export_->control().sample_rate = state().sampleRate;
+      export_->control().center_frequency = state().centerFrequency;
+      ringbuffer_.share_positions(&export_->control().positions);
+    }
+
+    // Serve rtl_tcp clients, last since it uses the device from its thread.
+    if (args.count("rtltcp")) {
+      rtlTcpServer_ = std::make_unique<RtlTcpServer>(this, args.at("rtltcp"));
+    }
+    phase("services");
+  } catch (...) {
+    cleanup();
+    throw;
   }
+}
 
-  // Sort smallest first
-  std::sort(rates.begin(), rates.end());
+SoapyAirspyHF::~SoapyAirspyHF(void) { cleanup(); }
 
-  // Set first sample rate as default
-  ret = airspyhf_set_samplerate(device_, rates.front());
-  if (ret != AIRSPYHF_SUCCESS) {
-    SoapySDR::logf(SOAPY_SDR_ERROR, "airspyhf_set_samplerate() failed: (%d)",
-                   ret);
+void SoapyAirspyHF::cleanup() {
+  // Stop changing gains. Swap under the lock, destroy (join) outside it,
+  // the rx callback takes the lock too.
+  std::unique_ptr<GainSupervisor> supervisor;
+  {
+    std::unique_lock<std::mutex> lock(statsLock_);
+    gainSupervisor_.swap(supervisor);
   }
-  // Store
-  sampleRate_ = rates.front();
+  supervisor.reset();
 
-  // Enables/Disables the IQ Correction, IF shift and Fine Tuning.
-  ret = airspyhf_set_lib_dsp(device_, 1);
-  if (ret != AIRSPYHF_SUCCESS) {
-    SoapySDR::logf(SOAPY_SDR_ERROR, "airspyhf_set_lib_dsp() failed: (%d)", ret);
+  // These close their streams, so first.
+  recorder_.reset();
+  rtlTcpServer_.reset();
+
+  // Apply what's pending, nothing posts after this.
+  controlQueue_.reset();
+
+  // Stop streaming, then the watchdog, which finds nothing to recover.
+  {
+    std::unique_lock<std::mutex> lock(streamsLock_);
+    if (started_) {
+      stopDevice();
+    }
   }
-}
+  watchdog_.reset();
 
-SoapyAirspyHF::~SoapyAirspyHF(void) {
-  const int ret = airspyhf_close(device_);
-  if (ret != AIRSPYHF_SUCCESS) {
-    SoapySDR::logf(SOAPY_SDR_ERROR, "airspyhf_close() failed: %d", ret);
+  ringbuffer_.share_positions(nullptr);
+
+  // Gone if the last recovery failed
+  if (device_) {
+    const int ret = airspyhf_close(device_);
+    if (ret != AIRSPYHF_SUCCESS) {
+      SoapySDR::logf(SOAPY_SDR_ERROR, "airspyhf_close() failed: %d", ret);
+    }
   }
+  device_ = nullptr;
 }
 
 /*******************************************************************
@@ -132,6 +301,29 @@ SoapySDR::Kwargs SoapyAirspyHF::getHardwareInfo(void) const {
   serialstr.str("");
   serialstr << std::hex << serial_;
   args["serial"] = serialstr.str();
+  // Not needed to stream, so not read at open.
+  std::call_once(boardInfoOnce_, [this] {
+    char version[255] = {};
+    int ret =
+        usb(airspyhf_version_string_read, version,
+            static_cast<uint8_t>(sizeof(version) - 1));
+    if (ret != AIRSPYHF_SUCCESS) {
+      SoapySDR::logf(SOAPY_SDR_WARNING,
+                     "airspyhf_version_string_read() failed: %d", ret);
+    }
+    boardInfo_["firmware"] = version;
+
+    airspyhf_read_partid_serialno_t partid = {};
+    ret = usb(airspyhf_board_partid_serialno_read, &partid);
+    if (ret != AIRSPYHF_SUCCESS) {
+      SoapySDR::logf(SOAPY_SDR_WARNING,
+                     "airspyhf_board_partid_serialno_read() failed: %d", ret);
+    }
+    std::stringstream partidstr;
+    partidstr << "0x" << std::hex << partid.part_id;
+    boardInfo_["part_id"] = partidstr.str();
+  });
+  args.insert(boardInfo_.begin(), boardInfo_.end());
 
   return args;
 }
@@ -248,17 +440,19 @@ void SoapyAirspyHF::setIQBalance(const int direction, const size_t channel,
     return;
   }
 
-  if (iqBalance_ != balance) {
-    // TODO
-    const int ret = airspyhf_set_optimal_iq_correction_point(device_, 0);
-    if (ret != AIRSPYHF_SUCCESS) {
-      SoapySDR::logf(SOAPY_SDR_ERROR,
-                     "airspyhf_set_optimal_iq_correction_point() failed: %d",
-                     ret);
-    } else {
-      iqBalance_ = balance;
-    }
+  if (state().iqBalance == balance) {
+    return;
   }
+  // TODO
+  // Transfer outside updateState, readers of the state don't wait for USB.
+  const int ret = usb(airspyhf_set_optimal_iq_correction_point, 0.0f);
+  if (ret != AIRSPYHF_SUCCESS) {
+    SoapySDR::logf(SOAPY_SDR_ERROR,
+                   "airspyhf_set_optimal_iq_correction_point() failed: %d",
+                   ret);
+    return;
+  }
+  updateState([&](DeviceState &state) { state.iqBalance = balance; });
 }
 
 std::complex<double> SoapyAirspyHF::getIQBalance(const int direction,
@@ -270,7 +464,7 @@ std::complex<double> SoapyAirspyHF::getIQBalance(const int direction,
     return std::complex<double>(0, 0);
   }
 
-  return iqBalance_;
+  return state().iqBalance;
 }
 
 bool SoapyAirspyHF::hasFrequencyCorrection(const int direction,
@@ -307,15 +501,20 @@ void SoapyAirspyHF::setFrequencyCorrection(const int direction,
   // Convert from PPM to PPB
   const int32_t correction_ppb = static_cast<int>(std::round(value * 1000));
 
-  if (frequencyCorrection_ != correction_ppb) {
-    int ret = airspyhf_set_calibration(device_, correction_ppb);
-    if (ret != AIRSPYHF_SUCCESS) {
-      SoapySDR::logf(SOAPY_SDR_ERROR, "airspyhf_set_calibration() failed: %d",
-                     ret);
-    } else {
-      frequencyCorrection_ = correction_ppb;
-    }
+  const auto current = state();
+  if (current.frequencyCorrection == correction_ppb) {
+    return;
   }
+  const int ret =
+      usb(airspyhf_set_calibration,
+          static_cast<int32_t>(correction_ppb + current.calibrationPpb));
+  if (ret != AIRSPYHF_SUCCESS) {
+    SoapySDR::logf(SOAPY_SDR_ERROR, "airspyhf_set_calibration() failed: %d",
+                   ret);
+    return;
+  }
+  updateState(
+      [&](DeviceState &state) { state.frequencyCorrection = correction_ppb; });
 }
 
 double SoapyAirspyHF::getFrequencyCorrection(const int direction,
@@ -333,7 +532,7 @@ double SoapyAirspyHF::getFrequencyCorrection(const int direction,
   }
 
   // Convert from PPB to PPM
-  return frequencyCorrection_ / 1000.0;
+  return state().frequencyCorrection / 1000.0;
 }
 
 /*******************************************************************
@@ -384,15 +583,22 @@ void SoapyAirspyHF::setGainMode(const int direction, const size_t channel,
     return;
   }
 
-  if (agcEnabled_ != automatic) {
+  // The hardware AGC takes over from the supervisor.
+  if (automatic) {
+    stopGainSupervisor("setGainMode");
+  }
+
+  if (state().agcEnabled != automatic) {
     SoapySDR::logf(SOAPY_SDR_DEBUG, "setGainMode(%d, %d, %d)", direction,
                    channel, automatic);
-    int ret = airspyhf_set_hf_agc(device_, automatic);
-    if (ret != AIRSPYHF_SUCCESS) {
-      SoapySDR::logf(SOAPY_SDR_ERROR, "airspyhf_set_hf_att() failed: %d", ret);
-    } else {
-      agcEnabled_ = automatic;
-    }
+    updateState([&](DeviceState &state) { state.agcEnabled = automatic; });
+    control("AGC", [this, automatic] {
+      const int ret = usb(airspyhf_set_hf_agc, automatic);
+      if (ret != AIRSPYHF_SUCCESS) {
+        SoapySDR::logf(SOAPY_SDR_ERROR, "airspyhf_set_hf_agc() failed: %d",
+                       ret);
+      }
+    });
   }
 }
 
@@ -405,7 +611,7 @@ bool SoapyAirspyHF::getGainMode(const int direction,
     return false;
   }
 
-  return agcEnabled_;
+  return state().agcEnabled;
 }
 
 SoapySDR::Range SoapyAirspyHF::getGainRange(const int direction,
@@ -443,9 +649,9 @@ double SoapyAirspyHF::getGain(const int direction, const size_t channel,
   }
 
   if (name == "LNA") {
-    return lnaGain_;
+    return state().lnaGain;
   } else if (name == "HF_ATT") {
-    return hfAttenuation_;
+    return state().hfAttenuation;
   } else {
     SoapySDR::logf(SOAPY_SDR_ERROR, "getGain(%d, %d, %s) not supported.",
                    direction, channel, name.c_str());
@@ -477,25 +683,59 @@ void SoapyAirspyHF::setGain(const int direction, const size_t channel,
     return;
   }
 
-  if (name == "LNA") {
-    const int ret = airspyhf_set_hf_lna(device_, value > 3 ? 1 : 0);
+  if (name == "LNA" or name == "HF_ATT") {
+    const auto range = getGainRange(direction, channel, name);
+    if (value < range.minimum() or value > range.maximum()) {
+      SoapySDR::logf(SOAPY_SDR_ERROR, "setGain(%d, %d, %s, %f) out of range.",
+                     direction, channel, name.c_str(), value);
+      return;
+    }
+    stopGainSupervisor("setGain");
+
+    // Report the new gain at once, it's applied later.
+    updateState([&](DeviceState &state) {
+      (name == "LNA" ? state.lnaGain : state.hfAttenuation) = value;
+    });
+    control(name, [this, name, value] { applyGain(name, value); });
+  } else {
+    SoapySDR::logf(SOAPY_SDR_ERROR, "setGain(%d, %d, %s, %f) not supported.",
+                   direction, channel, name.c_str(), value);
+  }
+}
+
+void SoapyAirspyHF::applyGain(const std::string &name, const double value) {
+  const auto from = ringbuffer_.write_position();
+  const bool lna = name == "LNA";
+  int ret = 0;
+  if (lna) {
+    ret = usb(airspyhf_set_hf_lna, static_cast<uint8_t>(value > 3 ? 1 : 0));
     if (ret != AIRSPYHF_SUCCESS) {
       SoapySDR::logf(SOAPY_SDR_ERROR, "airspyhf_set_hf_lna() failed: %d", ret);
-    } else {
-      lnaGain_ = value;
     }
-
   } else if (name == "HF_ATT") {
     const uint8_t att = static_cast<uint8_t>(std::round(value / -6));
-    const int ret = airspyhf_set_hf_att(device_, att);
+    ret = usb(airspyhf_set_hf_att, att);
     if (ret != AIRSPYHF_SUCCESS) {
       SoapySDR::logf(SOAPY_SDR_ERROR, "airspyhf_set_hf_att() failed: %d", ret);
-    } else {
-      hfAttenuation_ = value;
     }
   } else {
-    SoapySDR::logf(SOAPY_SDR_ERROR, "setGain(%d, %d, %s, %f) not supported.",
-                   direction, channel, name.c_str(), value);
+    return;
+  }
+
+  // On failure back to the device's gain, unless set again since.
+  updateState([&](DeviceState &state) {
+    auto &reported = lna ? state.lnaGain : state.hfAttenuation;
+    auto &applied = lna ? appliedLnaGain_ : appliedHfAttenuation_;
+    if (ret == AIRSPYHF_SUCCESS) {
+      reported = value;
+      applied = value;
+    } else if (reported == value) {
+      reported = applied;
+    }
+  });
+
+  if (ret == AIRSPYHF_SUCCESS) {
+    settle(from, Settling::Change::Gain);
   }
 }
 
@@ -514,8 +754,6 @@ void SoapyAirspyHF::setFrequency(const int direction, const size_t channel,
   SoapySDR::logf(SOAPY_SDR_DEBUG, "setFrequency(%d, %d, %s, %f)", direction,
                  channel, name.c_str(), frequency);
 
-  int ret = 0;
-
   if (direction != SOAPY_SDR_RX or name != "RF" or channel != 0) {
     SoapySDR::logf(SOAPY_SDR_ERROR,
                    "setFrequency(%d, %d, %s, %f) not supported.", direction,
@@ -523,15 +761,66 @@ void SoapyAirspyHF::setFrequency(const int direction, const size_t channel,
     return;
   }
 
-  centerFrequency_ = (uint32_t)frequency;
+  updateState([&](DeviceState &state) {
+    state.centerFrequency = static_cast<uint32_t>(frequency);
+  });
 
   SoapySDR::logf(SOAPY_SDR_DEBUG, "setFrequency(%d, %d, %s, %f)", direction,
                  channel, name.c_str(), frequency);
 
-  ret = airspyhf_set_freq(device_, centerFrequency_);
-  if (ret != AIRSPYHF_SUCCESS) {
+  if (export_) {
+    export_->control().center_frequency = static_cast<uint32_t>(frequency);
+  }
+
+  control("RF", [this, frequency] { applyFrequency(frequency); });
+}
+
+void SoapyAirspyHF::applyFrequency(const double frequency) {
+  const auto from = ringbuffer_.write_position();
+  int ret = usb(airspyhf_set_freq, static_cast<uint32_t>(frequency));
+  const bool tuned = ret == AIRSPYHF_SUCCESS;
+  if (not tuned) {
     SoapySDR::logf(SOAPY_SDR_ERROR, "airspyhf_set_freq() failed: %d", ret);
   }
+
+  if (calibration_) {
+    const auto point = calibration_->lookup(frequency);
+
+    ret = usb(airspyhf_set_optimal_iq_correction_point,
+              static_cast<float>(point.iqPoint));
+    if (ret != AIRSPYHF_SUCCESS) {
+      SoapySDR::logf(SOAPY_SDR_ERROR,
+                     "airspyhf_set_optimal_iq_correction_point() failed: %d",
+                     ret);
+    }
+
+    // On top of the user's correction
+    const double calibrationPpb = std::round(point.ppm * 1000);
+    DeviceState current;
+    updateState([&](DeviceState &state) {
+      state.calibrationGainDb = point.gainDb;
+      state.calibrationIqPoint = point.iqPoint;
+      current = state;
+    });
+    if (current.calibrationPpb != calibrationPpb) {
+      ret = usb(airspyhf_set_calibration,
+                static_cast<int32_t>(current.frequencyCorrection +
+                                     calibrationPpb));
+      if (ret != AIRSPYHF_SUCCESS) {
+        SoapySDR::logf(SOAPY_SDR_ERROR,
+                       "airspyhf_set_calibration() failed: %d", ret);
+      } else {
+        updateState([&](DeviceState &state) {
+          state.calibrationPpb = calibrationPpb;
+        });
+      }
+    }
+  }
+
+  if (tuned) {
+    settle(from, Settling::Change::Frequency,
+           frequency - tunedFrequency_.exchange(frequency));
+  }
 }
 
 double SoapyAirspyHF::getFrequency(const int direction, const size_t channel,
@@ -547,7 +836,7 @@ double SoapyAirspyHF::getFrequency(const int direction, const size_t channel,
     return 0.0;
   }
 
-  return centerFrequency_;
+  return state().centerFrequency;
 }
 
 std::vector<std::string>
@@ -570,7 +859,6 @@ SoapyAirspyHF::listFrequencies(const int direction,
 SoapySDR::RangeList
 SoapyAirspyHF::getFrequencyRange(const int direction, const size_t channel,
                                  const std::string &name) const {
-  SoapySDR::RangeList results;
 
   // Log debug
   SoapySDR::logf(SOAPY_SDR_DEBUG, "getFrequencyRange(%d, %d, %s)", direction,
@@ -581,14 +869,10 @@ SoapyAirspyHF::getFrequencyRange(const int direction, const size_t channel,
                    "getFrequencyRange(%d, %d, %s) not supported.", direction,
                    channel, name.c_str());
     // Empty results
-    return results;
+    return {};
   }
 
-  results.push_back(SoapySDR::Range(9'000, 31'000'000)); // 9kHz to 31MHz
-  results.push_back(
-      SoapySDR::Range(60'000'000, 260'000'000)); // 60MHz to 260MHz
-
-  return results;
+  return capabilities_.frequencyRanges;
 }
 
 SoapySDR::ArgInfoList
@@ -630,13 +914,67 @@ void SoapyAirspyHF::setSampleRate(const int direction, const size_t channel,
     return;
   }
 
-  sampleRate_ = static_cast<uint32_t>(rate);
+  const auto &rates = capabilities_.sampleRates;
+  if (std::find(rates.begin(), rates.end(), rate) == rates.end()) {
+    SoapySDR::logf(SOAPY_SDR_ERROR, "Unsupported sample rate %f", rate);
+    return;
+  }
+  const auto sampleRate = static_cast<uint32_t>(rate);
+
+  // Stop the device over the change so the new rate starts at a known
+  // ring position. Samples before it keep their rate.
+  std::unique_lock<std::mutex> lock(streamsLock_);
+  const bool started = started_;
+  const bool paused = paused_;
+  if (started) {
+    stopDevice();
+  }
 
-  ret = airspyhf_set_samplerate(device_, sampleRate_);
+  // The state keeps the old rate if the device does.
+  ret = usb(airspyhf_set_samplerate, sampleRate);
   if (ret != AIRSPYHF_SUCCESS) {
     SoapySDR::logf(SOAPY_SDR_ERROR, "airspyhf_set_samplerate() failed: %d",
                    ret);
-    return;
+  } else {
+    updateState([&](DeviceState &state) { state.sampleRate = sampleRate; });
+
+    const auto position = ringbuffer_.write_position();
+    timeline_.change(position, tickOffset_.load(std::memory_order_acquire),
+                     sampleRate);
+    const long long timeNs = writeTimeNs();
+    settle(position, Settling::Change::Rate);
+
+    // Streams switch rate, and equaliser, when their reader gets there.
+    for (auto &stream : streams_) {
+      std::unique_ptr<FirEqualiser> equaliser;
+      if (stream->equalised()) {
+        const auto *response =
+            passband_ ? passband_->response(sampleRate) : nullptr;
+        if (response) {
+          equaliser = std::make_unique<FirEqualiser>(*response);
+        } else {
+          SoapySDR::logf(SOAPY_SDR_WARNING,
+                         "No passband response for %u, not equalising",
+                         sampleRate);
+        }
+      }
+      stream->retune(position, sampleRate, std::move(equaliser));
+      if (stream->active()) {
+        stream->pushEvent({timeNs, AIRSPYHF_RATE_CHANGED});
+      }
+    }
+
+    if (export_) {
+      export_->control().sample_rate = sampleRate;
+    }
+  }
+
+  if (started) {
+    paused_ = paused;
+    ret = startDevice();
+    if (ret != AIRSPYHF_SUCCESS) {
+      SoapySDR::logf(SOAPY_SDR_ERROR, "airspyhf_start() failed: %d", ret);
+    }
   }
 }
 
@@ -652,14 +990,12 @@ double SoapyAirspyHF::getSampleRate(const int direction,
     return 0;
   }
 
-  return sampleRate_;
+  return state().sampleRate;
 }
 
 std::vector<double> SoapyAirspyHF::listSampleRates(const int direction,
                                                    const size_t channel) const {
 
-  std::vector<double> results;
-
   // Log debug
   SoapySDR::logf(SOAPY_SDR_DEBUG, "listSampleRates(%d, %d)", direction,
                  channel);
@@ -667,36 +1003,10 @@ std::vector<double> SoapyAirspyHF::listSampleRates(const int direction,
   if (direction != SOAPY_SDR_RX or channel != 0) {
     SoapySDR::logf(SOAPY_SDR_ERROR, "listSampleRates(%d, %d) not supported.",
                    direction, channel);
-    return results;
-  }
-
-  // Get number of sample rates
-  uint32_t numRates = 0;
-  int ret = airspyhf_get_samplerates(device_, &numRates, 0);
-  if (ret != AIRSPYHF_SUCCESS) {
-    SoapySDR::logf(SOAPY_SDR_ERROR, "airspyhf_get_samplerates() failed: %d",
-                   ret);
-    return results;
-  }
-
-  // Get sample rates
-  std::vector<uint32_t> samplerates(numRates, 0);
-
-  ret = airspyhf_get_samplerates(device_, samplerates.data(), numRates);
-  if (ret != AIRSPYHF_SUCCESS) {
-    SoapySDR::logf(SOAPY_SDR_ERROR, "airspyhf_get_samplerates() failed: %d",
-                   ret);
-    return results;
+    return {};
   }
 
-  // Sort to make short they are in order
-  std::sort(samplerates.begin(), samplerates.end());
-
-  // Use std::copy instead of loop
-  std::copy(samplerates.begin(), samplerates.end(),
-            std::back_inserter(results));
-
-  return results;
+  return capabilities_.sampleRates;
 }
 
 void SoapyAirspyHF::setBandwidth(const int direction, const size_t channel,
@@ -719,29 +1029,313 @@ double SoapyAirspyHF::getBandwidth(const int direction,
   }
 
   // TODO: this is just an estimate.
-  return 0.9 * sampleRate_;
+  return 0.9 * state().sampleRate;
 }
 
 std::vector<double> SoapyAirspyHF::listBandwidths(const int direction,
                                                   const size_t channel) const {
-  std::vector<double> results;
 
   // Log debug
   SoapySDR::logf(SOAPY_SDR_DEBUG, "listBandwidths(%d, %d)", direction, channel);
 
-  const auto sample_rates = listSampleRates(direction, channel);
+  if (direction != SOAPY_SDR_RX or channel != 0) {
+    SoapySDR::logf(SOAPY_SDR_ERROR, "listBandwidths(%d, %d) not supported.",
+                   direction, channel);
+    return {};
+  }
+
+  return capabilities_.bandwidths;
+}
+
+/*******************************************************************
+ * Sensor API
+ ******************************************************************/
+
+std::vector<std::string> SoapyAirspyHF::listSensors(const int direction,
+                                                    const size_t channel) const {
+
+  // Log debug
+  SoapySDR::logf(SOAPY_SDR_DEBUG, "listSensors(%d, %d)", direction, channel);
+
+  if (direction != SOAPY_SDR_RX or channel != 0) {
+    SoapySDR::logf(SOAPY_SDR_ERROR, "listSensors(%d, %d) not supported.",
+                   direction, channel);
+    return {};
+  }
+
+  return {"peak", "overload", "clipped", "histogram",
+          "rms", "noise_floor", "rms_dbm", "noise_floor_dbm"};
+}
+
+SoapySDR::ArgInfo SoapyAirspyHF::getSensorInfo(const int direction,
+                                               const size_t channel,
+                                               const std::string &key) const {
 
-  std::transform(sample_rates.begin(), sample_rates.end(),
-                 std::back_inserter(results),
-                 [](const double rate) { return 0.9 * rate; });
+  // Log debug
+  SoapySDR::logf(SOAPY_SDR_DEBUG, "getSensorInfo(%d, %d, %s)", direction,
+                 channel, key.c_str());
+
+  SoapySDR::ArgInfo info;
+  info.key = key;
+
+  if (key == "peak") {
+    info.name = "Peak";
+    info.description = "Peak magnitude of the last transfer";
+    info.units = "dBFS";
+    info.type = SoapySDR::ArgInfo::FLOAT;
+  } else if (key == "overload") {
+    info.name = "Overload";
+    info.description = "Samples of the last transfer were clipped";
+    info.type = SoapySDR::ArgInfo::BOOL;
+  } else if (key == "clipped") {
+    info.name = "Clipped";
+    info.description = "Clipped samples since open";
+    info.units = "samples";
+    info.type = SoapySDR::ArgInfo::INT;
+  } else if (key == "histogram") {
+    info.name = "Histogram";
+    info.description = "Samples of the last transfer per 6 dB band from 0 "
+                       "dBFS down, comma separated";
+    info.type = SoapySDR::ArgInfo::STRING;
+  } else if (key == "rms" or key == "rms_dbm") {
+    info.name = "RMS power";
+    info.description = "Wideband power, averaged over about a second";
+    if (key == "rms_dbm") {
+      info.description += ", empty with the hardware AGC";
+    }
+    info.units = key == "rms" ? "dBFS" : "dBm";
+    info.type = SoapySDR::ArgInfo::FLOAT;
+  } else if (key == "noise_floor" or key == "noise_floor_dbm") {
+    info.name = "Noise floor";
+    info.description = "Wideband power without carriers, estimated from a "
+                       "low percentile of FFT bins";
+    if (key == "noise_floor_dbm") {
+      info.description += ", empty with the hardware AGC";
+    }
+    info.units = key == "noise_floor" ? "dBFS" : "dBm";
+    info.type = SoapySDR::ArgInfo::FLOAT;
+  } else {
+    SoapySDR::logf(SOAPY_SDR_ERROR, "getSensorInfo(%d, %d, %s) not supported.",
+                   direction, channel, key.c_str());
+  }
 
-  return results;
+  return info;
+}
+
+std::string SoapyAirspyHF::readSensor(const int direction, const size_t channel,
+                                      const std::string &key) const {
+
+  // Log debug
+  SoapySDR::logf(SOAPY_SDR_DEBUG, "readSensor(%d, %d, %s)", direction, channel,
+                 key.c_str());
+
+  if (direction != SOAPY_SDR_RX or channel != 0) {
+    SoapySDR::logf(SOAPY_SDR_ERROR, "readSensor(%d, %d, %s) not supported.",
+                   direction, channel, key.c_str());
+    return "";
+  }
+
+  std::unique_lock<std::mutex> lock(statsLock_);
+
+  // dBFS to dBm at the antenna, with the current and calibrated gain.
+  const auto state = this->state();
+  const double dbm = fullScaleDbm_ - state.lnaGain - state.hfAttenuation -
+                     state.calibrationGainDb;
+  const auto db = [](const double power) {
+    return 10.0 * std::log10(std::max(power, 1e-20));
+  };
+
+  if (key == "peak") {
+    // Floor silence at -200 dBFS rather than -inf
+    return std::to_string(
+        10.0 * std::log10(std::max(lastStats_.peakPower, 1e-20f)));
+  } else if (key == "overload") {
+    return lastStats_.clipped > 0 ? "true" : "false";
+  } else if (key == "clipped") {
+    return std::to_string(clippedTotal_);
+  } else if (key == "histogram") {
+    std::string histogram;
+    for (const auto count : lastStats_.histogram) {
+      histogram += (histogram.empty() ? "" : ",") + std::to_string(count);
+    }
+    return histogram;
+  } else if (key == "rms") {
+    return std::to_string(db(level_.rmsPower()));
+  } else if (key == "noise_floor") {
+    return std::to_string(db(level_.noisePower()));
+  } else if (state.agcEnabled and
+             (key == "rms_dbm" or key == "noise_floor_dbm")) {
+    // The hardware AGC gain is unknown, so is the level at the antenna.
+    return "";
+  } else if (key == "rms_dbm") {
+    return std::to_string(db(level_.rmsPower()) + dbm);
+  } else if (key == "noise_floor_dbm") {
+    return std::to_string(db(level_.noisePower()) + dbm);
+  } else {
+    SoapySDR::logf(SOAPY_SDR_ERROR, "readSensor(%d, %d, %s) not supported.",
+                   direction, channel, key.c_str());
+    return "";
+  }
 }
 
 /*******************************************************************
  * Settings API
  ******************************************************************/
 
+// A flat JSON object of numbers, booleans and strings (without escapes) to
+// kwargs, values as they would be written as device args.
+static SoapySDR::Kwargs parseSettings(const std::string &json) {
+  SoapySDR::Kwargs settings;
+  size_t pos = 0;
+
+  const auto skip = [&] {
+    while (pos < json.size() and
+           std::isspace(static_cast<unsigned char>(json[pos]))) {
+      pos++;
+    }
+  };
+  const auto peek = [&](const char c) {
+    skip();
+    return pos < json.size() and json[pos] == c;
+  };
+  const auto expect = [&](const char c) {
+    if (not peek(c)) {
+      throw std::runtime_error(std::string("Expected '") + c + "' at " +
+                               std::to_string(pos));
+    }
+    pos++;
+  };
+  const auto string = [&] {
+    expect('"');
+    const auto end = json.find('"', pos);
+    if (end == std::string::npos) {
+      throw std::runtime_error("Unterminated string");
+    }
+    auto result = json.substr(pos, end - pos);
+    pos = end + 1;
+    return result;
+  };
+
+  expect('{');
+  if (not peek('}')) {
+    do {
+      const auto key = string();
+      expect(':');
+      if (peek('"')) {
+        settings[key] = string();
+      } else {
+        const auto end =
+            std::min(json.find_first_of(",} \t\r\n", pos), json.size());
+        if (end == pos) {
+          throw std::runtime_error("Missing value for " + key);
+        }
+        settings[key] = json.substr(pos, end - pos);
+        pos = end;
+      }
+    } while (peek(',') and ++pos);
+  }
+  expect('}');
+
+  skip();
+  if (pos != json.size()) {
+    throw std::runtime_error("Trailing characters after settings");
+  }
+  return settings;
+}
+
+// Value of a numeric setting, throws std::runtime_error unless it's all
+// a finite number.
+static double settingNumber(const std::string &key, const std::string &value) {
+  try {
+    size_t used = 0;
+    const double result = std::stod(value, &used);
+    if (used == value.size() and std::isfinite(result)) {
+      return result;
+    }
+  } catch (const std::logic_error &) {
+  }
+  throw std::runtime_error("Invalid value for " + key + ": " + value);
+}
+
+void SoapyAirspyHF::applySettings(const SoapySDR::Kwargs &settings) {
+  constexpr double max_correction_ppm = 1000;
+  const auto boolean = [](const std::string &key, const std::string &value) {
+    if (value != "true" and value != "false") {
+      throw std::runtime_error("Invalid value for " + key + ": " + value);
+    }
+    return value == "true";
+  };
+
+  // Check everything before changing anything.
+  const auto current = state();
+  auto wanted = current;
+  for (const auto &[key, value] : settings) {
+    if (key == "freq") {
+      const auto &ranges = capabilities_.frequencyRanges;
+      const double frequency = settingNumber(key, value);
+      if (std::none_of(ranges.begin(), ranges.end(), [&](const auto &range) {
+            return range.minimum() <= frequency and
+                   frequency <= range.maximum();
+          })) {
+        throw std::runtime_error("Unsupported frequency " + value);
+      }
+      wanted.centerFrequency = static_cast<uint32_t>(frequency);
+    } else if (key == "rate") {
+      const auto &rates = capabilities_.sampleRates;
+      const double rate = settingNumber(key, value);
+      if (std::find(rates.begin(), rates.end(), rate) == rates.end()) {
+        throw std::runtime_error("Unsupported sample rate " + value);
+      }
+      wanted.sampleRate = static_cast<uint32_t>(rate);
+    } else if (key == "lna" or key == "att") {
+      const auto range =
+          getGainRange(SOAPY_SDR_RX, 0, key == "lna" ? "LNA" : "HF_ATT");
+      const double gain = settingNumber(key, value);
+      if (gain < range.minimum() or gain > range.maximum()) {
+        throw std::runtime_error("Unsupported " + key + " " + value);
+      }
+      (key == "lna" ? wanted.lnaGain : wanted.hfAttenuation) = gain;
+    } else if (key == "agc") {
+      wanted.agcEnabled = boolean(key, value);
+    } else if (key == "ppm") {
+      // Far beyond any crystal, keeps the ppb with calibration in int32_t.
+      const double ppm = settingNumber(key, value);
+      if (std::abs(ppm) > max_correction_ppm) {
+        throw std::runtime_error("Unsupported ppm " + value);
+      }
+      wanted.frequencyCorrection = std::round(ppm * 1000);
+    } else if (key == "dsp") {
+      wanted.enableDSP = boolean(key, value);
+    } else {
+      throw std::runtime_error("Unknown setting " + key);
+    }
+  }
+
+  // Rate and DSP first, they reconfigure the library. The frequency last,
+  // its calibration point adds to ppm.
+  if (wanted.sampleRate != current.sampleRate) {
+    setSampleRate(SOAPY_SDR_RX, 0, wanted.sampleRate);
+  }
+  if (wanted.enableDSP != current.enableDSP) {
+    writeSetting("dsp", wanted.enableDSP ? "true" : "false");
+  }
+  if (wanted.frequencyCorrection != current.frequencyCorrection) {
+    setFrequencyCorrection(SOAPY_SDR_RX, 0, wanted.frequencyCorrection / 1000);
+  }
+  if (wanted.agcEnabled != current.agcEnabled) {
+    setGainMode(SOAPY_SDR_RX, 0, wanted.agcEnabled);
+  }
+  if (wanted.lnaGain != current.lnaGain) {
+    setGain(SOAPY_SDR_RX, 0, "LNA", wanted.lnaGain);
+  }
+  if (wanted.hfAttenuation != current.hfAttenuation) {
+    setGain(SOAPY_SDR_RX, 0, "HF_ATT", wanted.hfAttenuation);
+  }
+  if (wanted.centerFrequency != current.centerFrequency) {
+    setFrequency(SOAPY_SDR_RX, 0, "RF", wanted.centerFrequency, {});
+  }
+}
+
 SoapySDR::ArgInfoList SoapyAirspyHF::getSettingInfo(void) const {
 
   SoapySDR::ArgInfoList setArgs;
@@ -756,6 +1350,68 @@ SoapySDR::ArgInfoList SoapyAirspyHF::getSettingInfo(void) const {
   enableDSPArg.name = "DSP";
   enableDSPArg.description = "Enable DSP";
   enableDSPArg.type = SoapySDR::ArgInfo::BOOL;
+  setArgs.push_back(enableDSPArg);
+
+  // Record to an IQZ file, empty to stop.
+  SoapySDR::ArgInfo recordArg;
+  recordArg.key = "record";
+  recordArg.value = "";
+  recordArg.name = "Record";
+  recordArg.description = "Record compressed IQ to this file, empty to stop";
+  recordArg.type = SoapySDR::ArgInfo::STRING;
+  setArgs.push_back(recordArg);
+
+  SoapySDR::ArgInfo recordBitsArg;
+  recordBitsArg.key = "record_bits";
+  recordBitsArg.value = "16";
+  recordBitsArg.name = "Record bits";
+  recordBitsArg.description =
+      "Quantisation of recordings, lossless below this resolution";
+  recordBitsArg.type = SoapySDR::ArgInfo::INT;
+  recordBitsArg.range = SoapySDR::Range(8, 24, 1);
+  setArgs.push_back(recordBitsArg);
+
+  // Driver side gain control, steps LNA and HF_ATT.
+  SoapySDR::ArgInfo gainSupervisorArg;
+  gainSupervisorArg.key = "gain_supervisor";
+  gainSupervisorArg.value = "false";
+  gainSupervisorArg.name = "Gain supervisor";
+  gainSupervisorArg.description =
+      "Step LNA and HF_ATT from the signal level, replaces the hardware AGC";
+  gainSupervisorArg.type = SoapySDR::ArgInfo::BOOL;
+  setArgs.push_back(gainSupervisorArg);
+
+  // Wait for queued control commands to reach the device.
+  SoapySDR::ArgInfo controlFlushArg;
+  controlFlushArg.key = "control_flush";
+  controlFlushArg.value = "1000";
+  controlFlushArg.name = "Control flush";
+  controlFlushArg.description =
+      "Wait up to this many ms for frequency and gain changes to be applied";
+  controlFlushArg.units = "ms";
+  controlFlushArg.type = SoapySDR::ArgInfo::INT;
+  setArgs.push_back(controlFlushArg);
+
+  // Keep the device running when no stream is active.
+  SoapySDR::ArgInfo softPauseArg;
+  softPauseArg.key = "soft_pause";
+  softPauseArg.value = "false";
+  softPauseArg.name = "Soft pause";
+  softPauseArg.description =
+      "Keep USB streaming when the last stream is deactivated, activation "
+      "is then immediate";
+  softPauseArg.type = SoapySDR::ArgInfo::BOOL;
+  setArgs.push_back(softPauseArg);
+
+  // Several settings at once, only the changed ones are sent.
+  SoapySDR::ArgInfo applyArg;
+  applyArg.key = "apply";
+  applyArg.value = "{}";
+  applyArg.name = "Apply";
+  applyArg.description = "JSON object of freq, rate, lna, att, agc, ppm and "
+                         "dsp, applies the ones that changed";
+  applyArg.type = SoapySDR::ArgInfo::STRING;
+  setArgs.push_back(applyArg);
 
   return setArgs;
 }
@@ -771,12 +1427,80 @@ void SoapyAirspyHF::writeSetting(const std::string &key,
     bool enable = (value == "true");
 
     // Enables/Disables the IQ Correction, IF shift and Fine Tuning.
-    const int ret = airspyhf_set_lib_dsp(device_, enable);
+    const int ret = usb(airspyhf_set_lib_dsp, enable);
     if (ret != AIRSPYHF_SUCCESS) {
       SoapySDR::logf(SOAPY_SDR_ERROR, "airspyhf_set_lib_dsp() failed: (%d)",
                      ret);
     } else {
       SoapySDR::logf(SOAPY_SDR_DEBUG, "airspyhf_set_lib_dsp(%d)", enable);
+      updateState([&](DeviceState &state) { state.enableDSP = enable; });
+    }
+  } else if (key == "record") {
+    std::unique_lock<std::mutex> lock(recorderLock_);
+    // Stop the current recording first
+    recorder_.reset();
+    if (not value.empty()) {
+      recorder_ = std::make_unique<Recorder>(this, value, recordBits_);
+    }
+  } else if (key == "record_bits") {
+    try {
+      const double bits = settingNumber(key, value);
+      if (bits < 8 or bits > 24 or bits != std::floor(bits)) {
+        SoapySDR::logf(SOAPY_SDR_ERROR, "writeSetting(%s, %s) out of range.",
+                       key.c_str(), value.c_str());
+      } else {
+        std::unique_lock<std::mutex> lock(recorderLock_);
+        recordBits_ = static_cast<unsigned>(bits);
+      }
+    } catch (const std::runtime_error &e) {
+      SoapySDR::logf(SOAPY_SDR_ERROR, "writeSetting(%s): %s", key.c_str(),
+                     e.what());
+    }
+  } else if (key == "control_flush") {
+    // Wait for pending control commands, value is the timeout in ms.
+    try {
+      const double timeoutMs = value.empty() ? 1000 : settingNumber(key, value);
+      if (controlQueue_ and
+          not controlQueue_->flush(std::chrono::milliseconds(
+              static_cast<long>(std::clamp(timeoutMs, 0.0, 1e9))))) {
+        SoapySDR::logf(SOAPY_SDR_WARNING, "writeSetting(%s): timeout",
+                       key.c_str());
+      }
+    } catch (const std::runtime_error &e) {
+      SoapySDR::logf(SOAPY_SDR_ERROR, "writeSetting(%s): %s", key.c_str(),
+                     e.what());
+    }
+  } else if (key == "apply") {
+    try {
+      applySettings(parseSettings(value));
+    } catch (const std::runtime_error &e) {
+      SoapySDR::logf(SOAPY_SDR_ERROR, "writeSetting(%s): %s", key.c_str(),
+                     e.what());
+    }
+  } else if (key == "soft_pause") {
+    std::unique_lock<std::mutex> lock(streamsLock_);
+    softPause_ = value == "true";
+    // Paused without streams, stop for real.
+    if (started_ and activeStreams_ == 0 and not keepRunning()) {
+      stopDevice();
+    }
+  } else if (key == "gain_supervisor") {
+    std::unique_ptr<GainSupervisor> supervisor;
+    if (value == "true") {
+      // Don't fight the hardware AGC
+      setGainMode(SOAPY_SDR_RX, 0, false);
+      const auto state = this->state();
+      supervisor = std::make_unique<GainSupervisor>(
+          [this](const double lna, const double att) {
+            applySupervisedGain(lna, att);
+          },
+          state.lnaGain, state.hfAttenuation);
+    }
+
+    // Swap under the lock, destroy (join) outside it.
+    {
+      std::unique_lock<std::mutex> lock(statsLock_);
+      gainSupervisor_.swap(supervisor);
     }
   } else {
     SoapySDR::logf(SOAPY_SDR_ERROR, "writeSetting(%s, %s) not supported.",
@@ -793,7 +1517,72 @@ std::string SoapyAirspyHF::readSetting(const std::string &key) const {
   SoapySDR::logf(SOAPY_SDR_DEBUG, "readSetting(%s)", key.c_str());
 
   if (key == "dsp") {
-    return enableDSP_ ? "true" : "false";
+    return state().enableDSP ? "true" : "false";
+  } else if (key == "record") {
+    std::unique_lock<std::mutex> lock(recorderLock_);
+    return recorder_ ? recorder_->path() : "";
+  } else if (key == "record_stats") {
+    std::unique_lock<std::mutex> lock(recorderLock_);
+    return recorder_ ? recorder_->stats() : "";
+  } else if (key == "record_bits") {
+    std::unique_lock<std::mutex> lock(recorderLock_);
+    return std::to_string(recordBits_);
+  } else if (key == "soft_pause") {
+    std::unique_lock<std::mutex> lock(streamsLock_);
+    return softPause_ ? "true" : "false";
+  } else if (key == "gain_supervisor") {
+    std::unique_lock<std::mutex> lock(statsLock_);
+    return gainSupervisor_ ? "true" : "false";
+  } else if (key == "control_pending") {
+    return std::to_string(controlQueue_ ? controlQueue_->pending() : 0);
+  } else if (key == "control_coalesced") {
+    return std::to_string(controlQueue_ ? controlQueue_->coalesced() : 0);
+  } else if (key == "passband_response") {
+    // Measured response at the current sample rate, a line for the
+    // equaliser file.
+    std::unique_lock<std::mutex> lock(statsLock_);
+    std::ostringstream line;
+    line << state().sampleRate << std::fixed << std::setprecision(2);
+    for (const auto db : level_.response(64)) {
+      line << ' ' << db;
+    }
+    return line.str();
+  } else if (key == "passband_correction") {
+    // Correction in dB for spectra at the current sample rate, from the
+    // lowest frequency up.
+    const auto *response =
+        passband_ ? passband_->response(state().sampleRate) : nullptr;
+    std::string correction;
+    if (response) {
+      for (const auto db : PassbandTables::correction(*response)) {
+        correction += (correction.empty() ? "" : ",") + std::to_string(db);
+      }
+    }
+    return correction;
+  } else if (key == "watchdog_recoveries") {
+    return std::to_string(watchdog_ ? watchdog_->recoveries() : 0);
+  } else if (key == "startup") {
+    // Phases of open and activation to first transfer, ms
+    std::ostringstream timings;
+    timings << std::fixed << std::setprecision(3);
+    for (const auto &[phase, ms] : startup_) {
+      timings << (timings.tellp() > 0 ? "," : "") << phase << '=' << ms;
+    }
+    if (firstTransferMs_ >= 0) {
+      timings << ",first_transfer=" << firstTransferMs_;
+    }
+    return timings.str();
+  } else if (key == "calibration_gain") {
+    // Calibrated gain offset at the current frequency, dB
+    return std::to_string(state().calibrationGainDb);
+  } else if (key == "scales") {
+    // Current scale of each stream, in setupStream order.
+    std::unique_lock<std::mutex> lock(streamsLock_);
+    std::string scales;
+    for (const auto &stream : streams_) {
+      scales += (scales.empty() ? "" : ",") + std::to_string(stream->scale());
+    }
+    return scales;
   } else {
     SoapySDR::logf(SOAPY_SDR_ERROR, "readSetting(%s) not supported.",
                    key.c_str());
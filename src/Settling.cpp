@@ -0,0 +1,59 @@
+// Copyright 2024 SM6WJM
+
+#include "Settling.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+Settling::Table Settling::Table::load(const std::string &path) {
+  std::ifstream file(path);
+  if (not file) {
+    throw std::runtime_error("Could not open settling file " + path);
+  }
+
+  Table table;
+  std::vector<Step> steps;
+  std::string line;
+  size_t number = 0;
+  while (std::getline(file, line)) {
+    number++;
+
+    // Strip comments and skip blank lines
+    line = line.substr(0, line.find('#'));
+    if (line.find_first_not_of(" \t\r") == std::string::npos) {
+      continue;
+    }
+
+    std::istringstream fields(line);
+    std::string kind;
+    fields >> kind;
+    bool valid = false;
+    if (kind == "frequency") {
+      Step step{};
+      valid = static_cast<bool>(fields >> step.step_hz >> step.settle_us) and
+              step.step_hz > 0 and step.settle_us >= 0;
+      steps.push_back(step);
+    } else if (kind == "gain") {
+      valid = static_cast<bool>(fields >> table.gain_settle_us) and
+              table.gain_settle_us >= 0;
+    } else if (kind == "filter") {
+      long long samples = 0;
+      valid = static_cast<bool>(fields >> samples) and samples >= 0;
+      table.filter_samples = static_cast<size_t>(samples);
+    }
+    if (not valid) {
+      throw std::runtime_error("Invalid settling entry at " + path + ":" +
+                               std::to_string(number));
+    }
+  }
+
+  if (not steps.empty()) {
+    std::sort(steps.begin(), steps.end(), [](const Step &a, const Step &b) {
+      return a.step_hz < b.step_hz;
+    });
+    table.frequency_steps = std::move(steps);
+  }
+  return table;
+}
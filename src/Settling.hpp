@@ -0,0 +1,130 @@
+// Copyright 2024 SM6WJM
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "SeqLock.hpp"
+
+// Samples disturbed by control changes. After a retune the synthesizer
+// locks, after a gain step the front end settles, and after a rate change
+// or restart the decimation filters fill up. A transient is a range of
+// ring positions with such samples, the last `history` are kept so that
+// lagging readers still find theirs.
+class Settling {
+public:
+  enum class Change { Frequency, Gain, Rate };
+
+  // Ring positions [from, to), empty when from == to.
+  struct Transient {
+    size_t from;
+    size_t to;
+  };
+
+  static constexpr size_t history = 4;
+
+  // Settling time by frequency step, up to step_hz.
+  struct Step {
+    double step_hz;
+    double settle_us;
+  };
+
+  // Settling times. The defaults are estimates, not measured on a
+  // receiver. Measured ones can be loaded with the settling device arg
+  // from a text file with one entry per line, comments start with #:
+  //
+  //   frequency  10000  200   # step_hz settle_us
+  //   gain       500          # settle_us
+  //   filter     64           # samples
+  //
+  // Frequency lines replace the whole step table, steps larger than the
+  // last one take its time. Entries not given keep their defaults.
+  struct Table {
+    // Sorted by step_hz.
+    std::vector<Step> frequency_steps = {
+        {10e3, 200},
+        {1e6, 1000},
+        {10e6, 3000},
+        {std::numeric_limits<double>::infinity(), 5000},
+    };
+    // LNA and HF_ATT relay and bias.
+    double gain_settle_us = 500;
+    // Decimation filter tail, at the output rate.
+    size_t filter_samples = 64;
+
+    // Throws std::runtime_error if the file can't be read or parsed.
+    static Table load(const std::string &path);
+  };
+
+  const Table &table() const noexcept { return table_; }
+  // Only before any change, they read it unlocked.
+  void table(Table value) { table_ = std::move(value); }
+
+  // Samples to drop after change at samplerate, step is the frequency
+  // step in Hz.
+  size_t samples(const Change change, const double step,
+                 const double samplerate) const {
+    double settle_us = 0;
+    if (change == Change::Frequency) {
+      const auto &steps = table_.frequency_steps;
+      const auto it =
+          std::find_if(steps.begin(), steps.end(), [&](const Step &entry) {
+            return std::abs(step) <= entry.step_hz;
+          });
+      settle_us = it != steps.end() ? it->settle_us : steps.back().settle_us;
+    } else if (change == Change::Gain) {
+      settle_us = table_.gain_settle_us;
+    }
+    return static_cast<size_t>(std::ceil(settle_us * 1e-6 * samplerate)) +
+           table_.filter_samples;
+  }
+
+  // Samples in [from, to) are disturbed. Overlapping transients are
+  // merged. Changes are serialised by the caller.
+  void add(const size_t from, const size_t to) {
+    auto transients = transients_.load();
+
+    if (transients.count > 0) {
+      auto &last = transients.list.at((transients.count - 1) % history);
+      if (from <= last.to) {
+        last.to = std::max(last.to, to);
+        transients_.store(transients);
+        return;
+      }
+    }
+    transients.list.at(transients.count % history) = {from, to};
+    transients.count++;
+    transients_.store(transients);
+  }
+
+  // First transient not entirely before position, empty if none.
+  Transient next(const size_t position) const {
+    const auto transients = transients_.load();
+
+    const size_t oldest =
+        transients.count > history ? transients.count - history : 0;
+    for (size_t i = oldest; i < transients.count; i++) {
+      const auto &transient = transients.list.at(i % history);
+      if (position < transient.to) {
+        return transient;
+      }
+    }
+    return Transient{position, position};
+  }
+
+private:
+  Table table_;
+
+  struct Transients {
+    std::array<Transient, history> list;
+    size_t count;
+  };
+  SeqLock<Transients> transients_;
+};
@@ -0,0 +1,163 @@
+// Copyright 2024 SM6WJM
+
+#include "SharedExport.hpp"
+
+#include <SoapySDR/Logger.hpp>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+// Reopen a memfd read only, clients can then only map it PROT_READ.
+static int reopen_read_only(const int fd) {
+  const std::string proc_path = "/proc/self/fd/" + std::to_string(fd);
+  const int ro_fd = open(proc_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (ro_fd == -1) {
+    throw std::runtime_error("Could not reopen memfd read only: " +
+                             std::string(strerror(errno)));
+  }
+  return ro_fd;
+}
+
+SharedExport::SharedExport(const std::string &path, const int ring_fd,
+                           const size_t capacity, const size_t element_size)
+    : path_(path), ring_fd_(-1), control_fd_(-1), control_(nullptr),
+      listen_fd_(-1), running_(true) {
+
+  try {
+    ring_fd_ = reopen_read_only(ring_fd);
+
+    // Control block
+    const int control_fd = memfd_create("soapy_ring_control", MFD_CLOEXEC);
+    if (control_fd == -1) {
+      throw std::runtime_error("Could not create control memfd: " +
+                               std::string(strerror(errno)));
+    }
+
+    if (ftruncate(control_fd, sizeof(SharedControl)) == -1) {
+      close(control_fd);
+      throw std::runtime_error("Could not ftruncate control memfd: " +
+                               std::string(strerror(errno)));
+    }
+
+    void *control = mmap(NULL, sizeof(SharedControl), PROT_READ | PROT_WRITE,
+                         MAP_SHARED, control_fd, 0);
+    if (control == MAP_FAILED) {
+      close(control_fd);
+      throw std::runtime_error("Could not mmap control block: " +
+                               std::string(strerror(errno)));
+    }
+
+    control_ = new (control) SharedControl{};
+    control_->magic = SharedControl::magic_value;
+    control_->version = SharedControl::version_value;
+    control_->capacity = capacity;
+    control_->element_size = static_cast<uint32_t>(element_size);
+    control_->position_bits = static_cast<uint32_t>(8 * sizeof(size_t));
+
+    control_fd_ = reopen_read_only(control_fd);
+    close(control_fd);
+
+    // Socket, replace a stale one from a previous run.
+    sockaddr_un addr{};
+    if (path.size() >= sizeof(addr.sun_path)) {
+      throw std::runtime_error("Export socket path too long: " + path);
+    }
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(path.c_str());
+
+    listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd_ == -1 or
+        bind(listen_fd_, reinterpret_cast<const sockaddr *>(&addr),
+             sizeof(addr)) == -1 or
+        listen(listen_fd_, 8) == -1) {
+      throw std::runtime_error("Could not listen on " + path + ": " +
+                               std::string(strerror(errno)));
+    }
+  } catch (...) {
+    cleanup();
+    throw;
+  }
+
+  thread_ = std::thread(&SharedExport::serve, this);
+
+  SoapySDR::logf(SOAPY_SDR_INFO, "Exporting ring buffer on %s", path.c_str());
+}
+
+SharedExport::~SharedExport() {
+  running_ = false;
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  cleanup();
+  unlink(path_.c_str());
+}
+
+void SharedExport::cleanup() noexcept {
+  if (listen_fd_ != -1) {
+    close(listen_fd_);
+  }
+  if (control_ != nullptr) {
+    munmap(control_, sizeof(SharedControl));
+  }
+  if (control_fd_ != -1) {
+    close(control_fd_);
+  }
+  if (ring_fd_ != -1) {
+    close(ring_fd_);
+  }
+}
+
+void SharedExport::serve() {
+  // Poll so we notice when we are stopped.
+  const int poll_timeout_ms = 200;
+
+  while (running_) {
+    pollfd pfd{listen_fd_, POLLIN, 0};
+    if (poll(&pfd, 1, poll_timeout_ms) <= 0) {
+      continue;
+    }
+
+    const int client = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if (client == -1) {
+      continue;
+    }
+
+    // Send the magic with both descriptors, then we are done with the
+    // client. It reads shared memory from now on.
+    uint32_t magic = SharedControl::magic_value;
+    iovec iov{&magic, sizeof(magic)};
+    alignas(cmsghdr) char cmsg_buf[CMSG_SPACE(2 * sizeof(int))] = {};
+
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsg_buf;
+    msg.msg_controllen = sizeof(cmsg_buf);
+
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(2 * sizeof(int));
+    const int fds[2] = {ring_fd_, control_fd_};
+    std::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if (sendmsg(client, &msg, MSG_NOSIGNAL) == -1) {
+      SoapySDR::logf(SOAPY_SDR_WARNING, "SharedExport: sendmsg failed: %s",
+                     strerror(errno));
+    } else {
+      SoapySDR::logf(SOAPY_SDR_DEBUG, "SharedExport: client connected");
+    }
+
+    close(client);
+  }
+}
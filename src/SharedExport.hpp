@@ -0,0 +1,38 @@
+// Copyright 2024 SM6WJM
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <thread>
+
+#include "SharedRing.hpp"
+
+// Exports a ring buffer to other local processes, see SharedRing.hpp for
+// the protocol and the client. Listens on a Unix socket and hands out read
+// only file descriptors of the ring buffer and the control block.
+class SharedExport {
+  std::string path_;
+  // Read only descriptors handed to clients.
+  int ring_fd_;
+  int control_fd_;
+  SharedControl *control_;
+  int listen_fd_;
+
+  std::atomic<bool> running_;
+  std::thread thread_;
+
+  void serve();
+  void cleanup() noexcept;
+
+public:
+  SharedExport(const std::string &path, int ring_fd, size_t capacity,
+               size_t element_size);
+  ~SharedExport();
+
+  SharedExport(const SharedExport &) = delete;
+  SharedExport &operator=(const SharedExport &) = delete;
+
+  SharedControl &control() { return *control_; }
+};
@@ -0,0 +1,236 @@
+// Copyright 2024 SM6WJM
+
+// Shared memory export of the device ring buffer to other local processes.
+//
+// The driver (see SharedExport.hpp) listens on a Unix socket. A client that
+// connects receives two read only file descriptors with SCM_RIGHTS: the
+// memfd backing the ring buffer and the memfd holding the SharedControl
+// block below. The client maps the ring buffer twice, like the driver does,
+// and reads samples in place. Clients never hold back the driver, like
+// dropping readers they detect when they have been overrun.
+//
+// This header has no dependencies on SoapySDR or libairspyhf so it can be
+// used as is by sister processes.
+
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "RingBuffer.hpp"
+
+// Control block in shared memory, written by the driver only.
+struct SharedControl {
+  static constexpr uint32_t magic_value = 0x41484652; // "AHFR"
+  static constexpr uint32_t version_value = 1;
+
+  uint32_t magic;
+  uint32_t version;
+  // Capacity in elements, a power of two.
+  uint64_t capacity;
+  // Size of one element in bytes, elements are interleaved float I/Q.
+  uint32_t element_size;
+  // Width of the driver's positions, they wrap around at 2^position_bits.
+  uint32_t position_bits;
+
+  RingPositions positions;
+
+  // Samples lost before reaching the ring buffer. Position plus offset is
+  // the tick count, the number of samples received since open.
+  cacheline_aligned std::atomic<int64_t> tick_offset;
+  std::atomic<uint64_t> sample_rate;
+  std::atomic<uint64_t> center_frequency;
+};
+
+// Client side of the shared ring buffer.
+class SharedRingClient {
+  int ring_fd_ = -1;
+  int control_fd_ = -1;
+  const SharedControl *control_ = nullptr;
+  const uint8_t *buffer_ = nullptr;
+  size_t size_ = 0;
+  uint64_t position_mask_ = 0;
+
+  uint64_t read_pos_ = 0;
+  size_t overruns_ = 0;
+
+  // Receive the two file descriptors from the driver.
+  void receive(const std::string &path) {
+    const int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock == -1) {
+      throw std::runtime_error("Could not create socket: " +
+                               std::string(strerror(errno)));
+    }
+
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    if (connect(sock, reinterpret_cast<const sockaddr *>(&addr),
+                sizeof(addr)) == -1) {
+      close(sock);
+      throw std::runtime_error("Could not connect to " + path + ": " +
+                               std::string(strerror(errno)));
+    }
+
+    uint32_t magic = 0;
+    iovec iov{&magic, sizeof(magic)};
+    alignas(cmsghdr) char cmsg_buf[CMSG_SPACE(2 * sizeof(int))];
+
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsg_buf;
+    msg.msg_controllen = sizeof(cmsg_buf);
+
+    const auto received = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    close(sock);
+
+    const cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (received != sizeof(magic) or magic != SharedControl::magic_value or
+        cmsg == nullptr or cmsg->cmsg_type != SCM_RIGHTS or
+        cmsg->cmsg_len != CMSG_LEN(2 * sizeof(int))) {
+      throw std::runtime_error("Invalid shared ring buffer message from " +
+                               path);
+    }
+
+    int fds[2];
+    std::memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    ring_fd_ = fds[0];
+    control_fd_ = fds[1];
+  }
+
+  void map() {
+    void *control = mmap(NULL, sizeof(SharedControl), PROT_READ, MAP_SHARED,
+                         control_fd_, 0);
+    if (control == MAP_FAILED) {
+      throw std::runtime_error("Could not mmap control block: " +
+                               std::string(strerror(errno)));
+    }
+    control_ = static_cast<const SharedControl *>(control);
+
+    if (control_->version != SharedControl::version_value) {
+      throw std::runtime_error("Unsupported shared ring buffer version: " +
+                               std::to_string(control_->version));
+    }
+
+    size_ = control_->capacity * control_->element_size;
+    position_mask_ = control_->position_bits >= 64
+                         ? ~uint64_t(0)
+                         : (uint64_t(1) << control_->position_bits) - 1;
+
+    // Same mirrored mapping as RingBuffer, but read only.
+    void *buffer =
+        mmap(NULL, 2 * size_, PROT_NONE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (buffer == MAP_FAILED) {
+      throw std::runtime_error("Could not mmap buffer: " +
+                               std::string(strerror(errno)));
+    }
+
+    for (size_t half = 0; half < 2; half++) {
+      void *hint = static_cast<uint8_t *>(buffer) + half * size_;
+      if (mmap(hint, size_, PROT_READ, MAP_SHARED | MAP_FIXED, ring_fd_, 0) !=
+          hint) {
+        munmap(buffer, 2 * size_);
+        throw std::runtime_error("Could not mmap mirror: " +
+                                 std::string(strerror(errno)));
+      }
+    }
+
+    buffer_ = static_cast<const uint8_t *>(buffer);
+  }
+
+  void cleanup() noexcept {
+    if (buffer_ != nullptr) {
+      munmap(const_cast<uint8_t *>(buffer_), 2 * size_);
+    }
+    if (control_ != nullptr) {
+      munmap(const_cast<SharedControl *>(control_), sizeof(SharedControl));
+    }
+    if (ring_fd_ != -1) {
+      close(ring_fd_);
+    }
+    if (control_fd_ != -1) {
+      close(control_fd_);
+    }
+  }
+
+  uint64_t write_pos() const noexcept {
+    return control_->positions.write_pos.load(std::memory_order_acquire);
+  }
+
+public:
+  // Connect to the socket given with the export device arg and start
+  // reading from the newest sample.
+  explicit SharedRingClient(const std::string &path) {
+    try {
+      receive(path);
+      map();
+    } catch (...) {
+      cleanup();
+      throw;
+    }
+    clear();
+  }
+
+  ~SharedRingClient() { cleanup(); }
+
+  SharedRingClient(const SharedRingClient &) = delete;
+  SharedRingClient &operator=(const SharedRingClient &) = delete;
+
+  const SharedControl &control() const noexcept { return *control_; }
+
+  size_t overruns() const noexcept { return overruns_; }
+
+  // Tick of the next element to read.
+  long long ticks() const noexcept {
+    return static_cast<long long>(read_pos_) +
+           control_->tick_offset.load(std::memory_order_acquire);
+  }
+
+  // Available elements to read
+  size_t available() const noexcept {
+    return static_cast<size_t>((write_pos() - read_pos_) & position_mask_);
+  }
+
+  // Pointer to read location, valid for available() elements.
+  const void *read_ptr() const noexcept {
+    return buffer_ +
+           (read_pos_ & (control_->capacity - 1)) * control_->element_size;
+  }
+
+  // Check if the driver has overwritten, or is about to overwrite, the data
+  // at the read position. Check before reading, consume() checks again
+  // after.
+  bool overrun() const noexcept {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const uint64_t reserve =
+        control_->positions.reserve_pos.load(std::memory_order_relaxed);
+    return ((reserve - read_pos_) & position_mask_) > control_->capacity;
+  }
+
+  // Indicate number of elements read. Returns false, and skips to the newest
+  // data, if what was read was overwritten while reading it.
+  bool consume(const size_t elements) noexcept {
+    if (overrun()) {
+      overruns_++;
+      clear();
+      return false;
+    }
+    read_pos_ = (read_pos_ + elements) & position_mask_;
+    return true;
+  }
+
+  // Skip everything written so far.
+  void clear() noexcept { read_pos_ = write_pos(); }
+};
@@ -0,0 +1,125 @@
+// Copyright 2024 SM6WJM
+
+#include "SignalLevel.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+SignalLevel::SignalLevel()
+    : twiddles_(fft_size / 2), reversed_(fft_size), window_(fft_size),
+      windowPower_(0), fft_(fft_size), bins_(fft_size), spectrum_(fft_size),
+      rmsPower_(0), noisePower_(0), valid_(false), sinceFft_(fft_interval) {
+
+  const double pi = std::acos(-1.0);
+
+  for (size_t k = 0; k < fft_size / 2; k++) {
+    twiddles_[k] = std::polar(
+        1.0f, static_cast<float>(-2 * pi * static_cast<double>(k) / fft_size));
+  }
+
+  size_t bits = 0;
+  while ((size_t(1) << bits) < fft_size) {
+    bits++;
+  }
+  for (size_t i = 0; i < fft_size; i++) {
+    size_t r = 0;
+    for (size_t b = 0; b < bits; b++) {
+      r |= ((i >> b) & 1) << (bits - 1 - b);
+    }
+    reversed_[i] = r;
+  }
+
+  // Hann window, and its power gain to normalise the bins with.
+  for (size_t i = 0; i < fft_size; i++) {
+    window_[i] = static_cast<float>(
+        0.5 - 0.5 * std::cos(2 * pi * static_cast<double>(i) / fft_size));
+    windowPower_ += window_[i] * window_[i];
+  }
+}
+
+// In place radix 2 FFT of fft_, input already in bit reversed order.
+void SignalLevel::transform() {
+  for (size_t half = 1; half < fft_size; half *= 2) {
+    const size_t stride = fft_size / (2 * half);
+    for (size_t start = 0; start < fft_size; start += 2 * half) {
+      for (size_t k = 0; k < half; k++) {
+        const auto t = twiddles_[k * stride] * fft_[start + k + half];
+        fft_[start + k + half] = fft_[start + k] - t;
+        fft_[start + k] += t;
+      }
+    }
+  }
+}
+
+void SignalLevel::update(const std::complex<float> *samples,
+                         const BlockStats &stats, const double samplerate) {
+  if (stats.samples == 0 or samplerate <= 0) {
+    return;
+  }
+
+  const double duration = static_cast<double>(stats.samples) / samplerate;
+  const double alpha = 1 - std::exp(-duration / time_constant);
+
+  const double power =
+      static_cast<double>(stats.sumPower) / static_cast<double>(stats.samples);
+  rmsPower_ = valid_ ? rmsPower_ + alpha * (power - rmsPower_) : power;
+
+  sinceFft_ += duration;
+  if (sinceFft_ < fft_interval or stats.samples < fft_size) {
+    valid_ = true;
+    return;
+  }
+
+  for (size_t i = 0; i < fft_size; i++) {
+    fft_[reversed_[i]] = samples[i] * window_[i];
+  }
+  transform();
+
+  const double gamma = 1 - std::exp(-sinceFft_ / spectrum_time_constant);
+  for (size_t i = 0; i < fft_size; i++) {
+    bins_[i] = std::norm(fft_[i]) / windowPower_;
+    spectrum_[i] += gamma * (static_cast<double>(bins_[i]) - spectrum_[i]);
+  }
+  std::nth_element(bins_.begin(), bins_.begin() + noise_bin, bins_.end());
+  const double noise = static_cast<double>(bins_[noise_bin] * noise_correction);
+
+  // Smooth over the FFTs, an FFT stands for fft_interval of samples.
+  const double beta = 1 - std::exp(-sinceFft_ / time_constant);
+  noisePower_ =
+      noisePower_ > 0 ? noisePower_ + beta * (noise - noisePower_) : noise;
+
+  sinceFft_ = 0;
+  valid_ = true;
+}
+
+std::vector<float> SignalLevel::response(const size_t points) const {
+  std::vector<float> result;
+  if (points == 0 or fft_size % points != 0) {
+    return result;
+  }
+
+  // Average groups of bins, from the lowest frequency up.
+  const size_t group = fft_size / points;
+  std::vector<double> power(points);
+  for (size_t p = 0; p < points; p++) {
+    for (size_t g = 0; g < group; g++) {
+      const size_t bin = (p * group + g + fft_size / 2) % fft_size;
+      power[p] += spectrum_[bin];
+    }
+  }
+
+  double reference = 0;
+  for (size_t p = points / 4; p < 3 * points / 4; p++) {
+    reference += power[p];
+  }
+  reference /= static_cast<double>(points / 2);
+  if (reference <= 0) {
+    return result;
+  }
+
+  for (const auto p : power) {
+    result.push_back(static_cast<float>(
+        10 * std::log10(std::max(p / reference, 1e-20))));
+  }
+  return result;
+}
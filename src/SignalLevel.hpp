@@ -0,0 +1,67 @@
+// Copyright 2024 SM6WJM
+
+#pragma once
+
+#include <complex>
+#include <cstddef>
+#include <vector>
+
+#include "Converters.hpp"
+
+// Running signal level and noise floor of the device, fed from the rx
+// callback, for the level sensors. Reading is O(1), all the work is done
+// when updating.
+//
+// The RMS level is smoothed from the block statistics. The noise floor is
+// a low percentile of the bins of a short FFT taken now and then, which
+// ignores the carriers that dominate the RMS on HF.
+class SignalLevel {
+  static constexpr size_t fft_size = 256;
+  // Percentile of the bins taken as noise, and the factor that turns it
+  // into the mean of exponentially distributed noise bins. The expected
+  // value of the 26th smallest of 256 is the sum of 1/m, m = 231..256.
+  static constexpr size_t noise_bin = fft_size / 10;
+  static constexpr float noise_correction = 9.356f;
+  // Interval between FFTs and smoothing time constant, in seconds.
+  static constexpr double fft_interval = 0.1;
+  static constexpr double time_constant = 1.0;
+  // Slower smoothing of the spectrum, for the passband response.
+  static constexpr double spectrum_time_constant = 10.0;
+
+  std::vector<std::complex<float>> twiddles_;
+  std::vector<size_t> reversed_;
+  std::vector<float> window_;
+  float windowPower_;
+
+  std::vector<std::complex<float>> fft_;
+  std::vector<float> bins_;
+  // Averaged bin power, in FFT order.
+  std::vector<double> spectrum_;
+
+  double rmsPower_;
+  double noisePower_;
+  bool valid_;
+  double sinceFft_;
+
+  void transform();
+
+public:
+  SignalLevel();
+
+  // Called with each transfer and its statistics.
+  void update(const std::complex<float> *samples, const BlockStats &stats,
+              double samplerate);
+
+  // Nothing measured yet
+  bool valid() const noexcept { return valid_; }
+
+  // Mean power of the signal and of the noise, full scale is 1.0.
+  double rmsPower() const noexcept { return rmsPower_; }
+  double noisePower() const noexcept { return noisePower_; }
+
+  // Averaged spectrum in dB relative to its centre half, at points equally
+  // spaced from -samplerate/2 to samplerate/2. With a flat input, noise or
+  // a terminated antenna, this is the passband response. points must
+  // divide the FFT size.
+  std::vector<float> response(size_t points) const;
+};
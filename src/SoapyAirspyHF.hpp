@@ -33,84 +33,402 @@
 
 #include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <complex>
+#include <condition_variable>
+#include <cstddef>
 #include <cstring>
+#include <deque>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <libairspyhf/airspyhf.h>
 
+#include "Calibration.hpp"
+#include "ControlQueue.hpp"
+#include "Converters.hpp"
+#include "DeviceState.hpp"
+#include "DigitalAgc.hpp"
+#include "Equaliser.hpp"
+#include "GainSupervisor.hpp"
+#include "Recorder.hpp"
 #include "RingBuffer.hpp"
-
-#define MAX_DEVICES 32
-
-// Class to hold the stream data
+#include "RtlTcpServer.hpp"
+#include "SeqLock.hpp"
+#include "Settling.hpp"
+#include "SharedExport.hpp"
+#include "SignalLevel.hpp"
+#include "Timeline.hpp"
+#include "Watchdog.hpp"
+
+// readStreamStatus flag, the gain was changed by the driver at timeNs.
+#define AIRSPYHF_GAIN_CHANGED SOAPY_SDR_USER_FLAG0
+// readStreamStatus flag, the device was reopened after an outage and
+// samples resume at timeNs.
+#define AIRSPYHF_RECONNECTED SOAPY_SDR_USER_FLAG1
+// readStreamStatus flag, the sample rate changed, samples at the new rate
+// start at timeNs.
+#define AIRSPYHF_RATE_CHANGED SOAPY_SDR_USER_FLAG2
+// readStream flag, the samples are disturbed by a control change, see the
+// settle stream arg.
+#define AIRSPYHF_SETTLING SOAPY_SDR_USER_FLAG3
+
+// Samples as delivered by libairspyhf
+using SampleRingBuffer = RingBuffer<airspyhf_complex_float_t>;
+
+// Class to hold the stream data. All streams of a device share the device
+// ring buffer, each stream reads it with its own reader and converter.
 class SoapySDR::Stream {
-  airspyhf_device_t *device_;
+public:
+  // What readStream does with samples disturbed by control changes.
+  enum class Settle { Off, Mark, Discard };
+
+private:
   double samplerate_;
+  std::string format_;
   SoapySDR::ConverterRegistry::ConverterFunction converterFunction_;
   size_t mtu_;
-  RingBuffer<airspyhf_complex_float_t> ringbuffer_;
+  bool blocking_;
+  // Scaler passed to the converter, follows the signal when autoScale_.
+  // With AGC the AGC gain, the samples are scaled before conversion.
+  std::atomic<double> scale_;
+  bool autoScale_;
+  std::unique_ptr<DigitalAgc> agc_;
+  std::unique_ptr<FirEqualiser> equaliser_;
+  // Whether the stream was set up with the equaliser.
+  bool equalise_;
+  // Keep the device running while set up, see the prewarm stream arg.
+  bool prewarm_;
+  Settle settle_;
+  // Application eventfd signalled for non-blocking reads, see
+  // AsyncRead.hpp. -1 for none.
+  int readyFd_;
+  // Only valid while the stream is active.
+  SampleRingBuffer::Reader reader_;
+
+  // Sample rate change not yet reached by the reader, see retune().
+  struct Retune {
+    size_t position;
+    double samplerate;
+    std::unique_ptr<FirEqualiser> equaliser;
+  };
+  std::mutex retuneLock_;
+  std::atomic<bool> retunePending_{false};
+  Retune retune_;
+
+  void applyRetune() {
+    std::unique_lock<std::mutex> lock(retuneLock_);
+    // Wrap around safe position >= retune_.position
+    if (static_cast<std::ptrdiff_t>(reader_.position() - retune_.position) <
+        0) {
+      return;
+    }
+    samplerate_ = retune_.samplerate;
+    equaliser_ = std::move(retune_.equaliser);
+    retunePending_.store(false, std::memory_order_relaxed);
+  }
 
 public:
-  std::atomic<long long> ticks_;
+  // Event for readStreamStatus, at a time.
+  struct Event {
+    long long timeNs;
+    int flags;
+  };
 
+private:
+  // Oldest events are dropped when nobody reads them.
+  static constexpr size_t max_events = 64;
+  std::mutex eventsLock_;
+  std::condition_variable eventsReady_;
+  std::deque<Event> events_;
+
+public:
   // Use MTU
-  Stream(airspyhf_device_t *device, double samplerate,
+  Stream(double samplerate, const std::string &format,
          SoapySDR::ConverterRegistry::ConverterFunction converterFunction,
-         size_t mtu)
-      : device_(device), samplerate_(samplerate),
-        converterFunction_(converterFunction), mtu_(mtu),
-        ringbuffer_(
-            8 *
-            2048){}; // TODO: make ringbuffer size a function of sample rate=?
-
-  virtual ~Stream() {
-    // Stop streaming if stream is dropped.
-    airspyhf_stop(device_);
+         size_t mtu, bool blocking, double scale, bool autoScale,
+         std::unique_ptr<DigitalAgc> agc,
+         std::unique_ptr<FirEqualiser> equaliser, bool prewarm,
+         Settle settle, int readyFd)
+      : samplerate_(samplerate), format_(format),
+        converterFunction_(converterFunction), mtu_(mtu), blocking_(blocking),
+        scale_(scale), autoScale_(autoScale), agc_(std::move(agc)),
+        equaliser_(std::move(equaliser)), equalise_(equaliser_ != nullptr),
+        prewarm_(prewarm), settle_(settle), readyFd_(readyFd){};
+
+  SampleRingBuffer::Reader &reader() { return reader_; };
+  bool active() const { return reader_.valid(); };
+  bool blocking() const { return blocking_; };
+  const std::string &format() const { return format_; };
+  double samplerate() const { return samplerate_; };
+  SoapySDR::ConverterRegistry::ConverterFunction converter() const {
+    return converterFunction_;
   };
-
-  void addTicks(long long ticks) {
-    ticks_.fetch_add(ticks, std::memory_order_release);
+  size_t MTU() const { return mtu_; };
+  double scale() const { return scale_.load(std::memory_order_relaxed); };
+  // Samples of delay added by processing, timestamps take it into account.
+  size_t delay() const { return equaliser_ ? FirEqualiser::delay() : 0; };
+
+  // From ring position on the samples are at samplerate, equalise them
+  // with equaliser (or not if null). Takes effect when the reader gets
+  // there.
+  void retune(const size_t position, const double samplerate,
+              std::unique_ptr<FirEqualiser> equaliser) {
+    std::unique_lock<std::mutex> lock(retuneLock_);
+    retune_ = {position, samplerate, std::move(equaliser)};
+    retunePending_.store(true, std::memory_order_release);
+  }
+  bool equalised() const { return equalise_; };
+  bool prewarm() const { return prewarm_; };
+  Settle settle() const { return settle_; };
+  int readyFd() const { return readyFd_; };
+
+  // Equalise, scale or apply AGC to, num samples at the reader position
+  // and convert them to the stream format.
+  void convert(const void *src, void *dst, size_t num) {
+    if (retunePending_.load(std::memory_order_acquire)) {
+      applyRetune();
+    }
+
+    if (equaliser_) {
+      src = equaliser_->process(src, num);
+    }
+
+    if (agc_) {
+      const void *scaled = agc_->process(src, num, samplerate_);
+      scale_.store(agc_->gain(), std::memory_order_relaxed);
+      converterFunction_(scaled, dst, num, 1.0);
+      return;
+    }
+
+    // With auto scale, keep the peak about 6 dB below full scale: follow
+    // rising peaks at once, falling ones slowly.
+    if (autoScale_) {
+      const double target =
+          0.5 / std::max(static_cast<double>(peakCF32(src, num)), 1e-4);
+      const double scale = scale_.load(std::memory_order_relaxed);
+      scale_.store(target < scale ? target : scale + 0.01 * (target - scale),
+                   std::memory_order_relaxed);
+    }
+
+    converterFunction_(src, dst, num, scale());
   }
 
-  long long ticks() const { return ticks_.load(std::memory_order_acquire); }
+  void pushEvent(const Event &event) {
+    {
+      std::unique_lock<std::mutex> lock(eventsLock_);
+      if (events_.size() == max_events) {
+        events_.pop_front();
+      }
+      events_.push_back(event);
+    }
+    eventsReady_.notify_one();
+  }
 
-  long long timeNs() const {
-    return SoapySDR::ticksToTimeNs(ticks(), samplerate_);
+  // Wait for the oldest event, false on timeout.
+  bool popEvent(Event &event, const std::chrono::microseconds timeout) {
+    std::unique_lock<std::mutex> lock(eventsLock_);
+    if (not eventsReady_.wait_for(lock, timeout,
+                                  [this] { return not events_.empty(); })) {
+      return false;
+    }
+    event = events_.front();
+    events_.pop_front();
+    return true;
   }
+};
 
-  RingBuffer<airspyhf_complex_float_t> &ringbuffer() { return ringbuffer_; };
-  airspyhf_device_t *device() const { return device_; };
-  double samplerate() const { return samplerate_; };
-  void setSamplerate(double samplerate) { samplerate_ = samplerate; };
-  SoapySDR::ConverterRegistry::ConverterFunction converter() const {
-    return converterFunction_;
-  };
-  size_t MTU() const { return mtu_; };
+// What the device supports, read once at open.
+struct DeviceCapabilities {
+  // Smallest first
+  std::vector<double> sampleRates;
+  std::vector<double> bandwidths;
+  SoapySDR::RangeList frequencyRanges;
+
+  // Calibration stored in flash, ppb
+  int32_t calibration = 0;
 };
 
 // SoapyAirspyHF device class
 class SoapyAirspyHF : public SoapySDR::Device {
 private:
-  // Device handle
+  // Device handle, replaced when the watchdog reopens the device and null
+  // while it's gone. Use it through usb().
   uint64_t serial_;
   airspyhf_device_t *device_;
+  mutable std::mutex usbLock_;
+
+  // Call a libairspyhf function on the device, AIRSPYHF_ERROR while it's
+  // gone.
+  template <typename... Params, typename... Args>
+  int usb(int (*call)(airspyhf_device_t *, Params...), Args &&...args) const {
+    std::unique_lock<std::mutex> lock(usbLock_);
+    return device_ ? call(device_, std::forward<Args>(args)...)
+                   : AIRSPYHF_ERROR;
+  }
+
+  // Set at open, read only after.
+  DeviceCapabilities capabilities_;
+
+  // Firmware version and part id, read from the device on first use.
+  mutable std::once_flag boardInfoOnce_;
+  mutable SoapySDR::Kwargs boardInfo_;
+
+  // Duration of each phase of open in ms, see the startup setting.
+  std::vector<std::pair<std::string, double>> startup_;
+  // When the device was last started, and the time to its first transfer
+  // in ms (negative until it arrived).
+  std::chrono::steady_clock::time_point startedAt_;
+  std::atomic<bool> awaitingTransfer_;
+  std::atomic<double> firstTransferMs_;
+
+  // Settings. Getters, the rx callback and the other threads read a
+  // consistent snapshot without locking, changes are serialised by
+  // stateLock_.
+  SeqLock<DeviceState> state_;
+  std::mutex stateLock_;
+  // Gains the device has, setGain reports its gain before it's applied.
+  // Under stateLock_.
+  double appliedLnaGain_ = 0;
+  double appliedHfAttenuation_ = 0;
+
+  DeviceState state() const { return state_.load(); }
+
+  template <typename Change> void updateState(Change change) {
+    std::unique_lock<std::mutex> lock(stateLock_);
+    auto state = state_.load();
+    change(state);
+    state_.store(state);
+  }
+
+  // Sample rate of the samples in the ring buffer, by position.
+  Timeline timeline_;
+
+  // Time of the next sample written to the ring buffer.
+  long long writeTimeNs() const {
+    const auto position = ringbuffer_.write_position();
+    size_t end;
+    return Timeline::time(timeline_.at(position, end), position,
+                          tickOffset_.load(std::memory_order_acquire));
+  }
+
+  // Ring positions of samples disturbed by control changes.
+  Settling settling_;
+  // Frequency last sent to the device, for the settling step.
+  std::atomic<double> tunedFrequency_;
+  // Samples from position from on are disturbed by change, step is the
+  // frequency step in Hz. Call after the change was sent.
+  void settle(size_t from, Settling::Change change, double step = 0);
+
+  // Samples from the device, shared by all streams. Sized in samples and
+  // not resized on rate changes, readers and the export map it live.
+  SampleRingBuffer ringbuffer_;
+  // Samples that never made it into the ring buffer. Ring buffer position
+  // plus offset is the number of samples received since open.
+  std::atomic<long long> tickOffset_;
+  // Host steady clock minus stream time at the end of a transfer, of the
+  // least delayed transfers, see hostTimeNs().
+  std::atomic<long long> hostOffsetNs_;
+
+  // Export of the ring buffer to other processes, see export device arg.
+  std::unique_ptr<SharedExport> export_;
+
+  // rtl_tcp server, see rtltcp device arg.
+  std::unique_ptr<RtlTcpServer> rtlTcpServer_;
+
+  // IQZ recorder, see record setting. Settings replace it while others
+  // read it.
+  mutable std::mutex recorderLock_;
+  std::unique_ptr<Recorder> recorder_;
+  unsigned recordBits_;
+
+  // Open streams and how many of them are active. The device is started
+  // while streams are active, and with soft pause also when none are, then
+  // the rx callback drops the samples.
+  mutable std::mutex streamsLock_;
+  std::vector<std::unique_ptr<SoapySDR::Stream>> streams_;
+  size_t activeStreams_;
+  bool started_;
+  bool softPause_;
+  std::atomic<bool> paused_;
+
+  // Start and stop the device, under streamsLock_.
+  int startDevice();
+  int stopDevice();
+  // Whether the device runs on without active streams, under streamsLock_.
+  bool keepRunning() const;
+  // Deactivate stream, under streamsLock_.
+  int deactivate(SoapySDR::Stream *stream);
+
+  // Stop the threads and close the device, for the destructor and a
+  // constructor that throws.
+  void cleanup();
+
+  // Statistics of the last transfer and clipped samples since open, see
+  // the sensors.
+  mutable std::mutex statsLock_;
+  BlockStats lastStats_;
+  uint64_t clippedTotal_;
+  SignalLevel level_;
+
+  // Level of a full scale signal at 0 dB gain, see the full_scale_dbm
+  // device arg.
+  double fullScaleDbm_;
+
+  // Per frequency calibration, see the calibration device arg.
+  std::unique_ptr<Calibration> calibration_;
+
+  // Passband responses for the equaliser, see the equaliser device arg.
+  std::unique_ptr<PassbandTables> passband_;
+
+  // Runs control transfers for the setters, see the async_control device
+  // arg.
+  std::unique_ptr<ControlQueue> controlQueue_;
+
+  // Run command on the control thread, or here without one. A command
+  // replaces a pending one with the same key.
+  void control(const std::string &key, std::function<void()> command) {
+    if (controlQueue_) {
+      controlQueue_->post(key, std::move(command));
+    } else {
+      command();
+    }
+  }
+
+  // Control transfers behind the setters.
+  void applyGain(const std::string &name, double value);
+  void applyFrequency(double frequency);
+
+  // Change freq, rate, lna, att, agc, ppm and dsp, only those that differ
+  // from the current state and in an order that suits the device. All
+  // values are checked first, nothing is changed if one is invalid.
+  void applySettings(const SoapySDR::Kwargs &settings);
 
-  uint32_t sampleRate_;
-  uint32_t centerFrequency_;
+  // Driver side gain control, see the gain_supervisor setting. Fed from
+  // the rx callback under statsLock_.
+  std::unique_ptr<GainSupervisor> gainSupervisor_;
 
-  bool enableDSP_;
-  bool agcEnabled_;
-  double lnaGain_;
-  double hfAttenuation_;
+  // Reopens the device when transfers stop, see the watchdog device arg.
+  std::unique_ptr<Watchdog> watchdog_;
 
-  double frequencyCorrection_;
-  std::complex<double> iqBalance_;
+  // Reopen and restart the device with the current settings and tell the
+  // streams, for the watchdog.
+  bool recover(Watchdog::Clock::duration gap);
 
-  // Current stream handle
-  std::unique_ptr<SoapySDR::Stream> stream_;
+  // Set gains chosen by the supervisor and tell the streams.
+  void applySupervisedGain(double lna, double att);
+
+  // Stop the gain supervisor, if running, because of caller's gain
+  // change. The supervisor would undo it otherwise.
+  void stopGainSupervisor(const char *caller);
+
+  // libairspyhf callback, ctx is this.
+  static int rxCallback(airspyhf_transfer_t *transfer);
 
 public:
   explicit SoapyAirspyHF(const SoapySDR::Kwargs &args);
@@ -119,6 +437,12 @@ public:
   SoapyAirspyHF(const SoapyAirspyHF &) = delete;
   SoapyAirspyHF &operator=(const SoapyAirspyHF &) = delete;
 
+  // Host steady clock time, in ns, of the sample at stream time timeNs.
+  // Estimated from the arrival of transfers, for aligning devices.
+  long long hostTimeNs(const long long timeNs) const {
+    return timeNs + hostOffsetNs_.load(std::memory_order_relaxed);
+  }
+
   /*******************************************************************
    * Identification API
    ******************************************************************/
@@ -168,6 +492,10 @@ public:
                  const size_t numElems, int &flags, long long &timeNs,
                  const long timeoutUs = 100000) override;
 
+  int readStreamStatus(SoapySDR::Stream *stream, size_t &chanMask, int &flags,
+                       long long &timeNs,
+                       const long timeoutUs = 100000) override;
+
   /*******************************************************************
    * Antenna API
    ******************************************************************/
@@ -287,6 +615,19 @@ public:
   std::vector<double> listBandwidths(const int direction,
                                      const size_t channel) const override;
 
+  /*******************************************************************
+   * Sensor API
+   ******************************************************************/
+
+  std::vector<std::string> listSensors(const int direction,
+                                       const size_t channel) const override;
+
+  SoapySDR::ArgInfo getSensorInfo(const int direction, const size_t channel,
+                                  const std::string &key) const override;
+
+  std::string readSensor(const int direction, const size_t channel,
+                         const std::string &key) const override;
+
   /*******************************************************************
    * Utility
    ******************************************************************/
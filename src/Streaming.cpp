@@ -26,16 +26,23 @@
 
 #include "SoapyAirspyHF.hpp"
 
+#include "AsyncRead.hpp"
+
 #include <SoapySDR/ConverterRegistry.hpp>
 #include <SoapySDR/Formats.hpp>
 #include <SoapySDR/Logger.hpp>
 
 #include <algorithm>
+#include <cerrno>
+#include <cmath>
 #include <libairspyhf/airspyhf.h>
+#include <limits>
 #include <memory>
 
 #include <cassert>
 
+#include <unistd.h>
+
 #define AIRSPYHF_NATIVE_FORMAT SOAPY_SDR_CF32
 
 std::vector<std::string>
@@ -54,7 +61,17 @@ SoapyAirspyHF::getStreamFormats(const int direction,
   }
 
   // Allow all formats we can convert to
-  return SoapySDR::ConverterRegistry::listTargetFormats(AIRSPYHF_NATIVE_FORMAT);
+  auto formats =
+      SoapySDR::ConverterRegistry::listTargetFormats(AIRSPYHF_NATIVE_FORMAT);
+
+  // Plus our own dithered packed formats
+  for (const auto &format : {SOAPY_SDR_CS12, SOAPY_SDR_CS8}) {
+    if (std::find(formats.begin(), formats.end(), format) == formats.end()) {
+      formats.push_back(format);
+    }
+  }
+
+  return formats;
 }
 
 std::string SoapyAirspyHF::getNativeStreamFormat(const int direction,
@@ -73,6 +90,8 @@ std::string SoapyAirspyHF::getNativeStreamFormat(const int direction,
     return {};
   }
 
+  // Other formats have the usual SoapySDR full scale (2047 for CS12, 127
+  // for CS8...) times the scale stream arg, see readSetting("scales").
   fullScale = 1.0;
   return AIRSPYHF_NATIVE_FORMAT;
 }
@@ -94,33 +113,206 @@ SoapyAirspyHF::getStreamArgsInfo(const int direction,
     return streamArgs;
   }
 
+  // Several streams can read the same device, a blocking stream holds back
+  // the device when it falls behind, a dropping stream loses samples instead.
+  SoapySDR::ArgInfo overflowArg;
+  overflowArg.key = "overflow";
+  overflowArg.value = "block";
+  overflowArg.name = "Overflow policy";
+  overflowArg.description =
+      "What to do when this stream can't keep up with the device";
+  overflowArg.type = SoapySDR::ArgInfo::STRING;
+  overflowArg.options = {"block", "drop"};
+  overflowArg.optionNames = {"Block", "Drop"};
+  streamArgs.push_back(overflowArg);
+
+  // Samples are multiplied by the scale before conversion, auto keeps the
+  // peak level about 6 dB below full scale. Useful with the narrow CS12 and
+  // CS8 formats, which are dithered.
+  SoapySDR::ArgInfo scaleArg;
+  scaleArg.key = "scale";
+  scaleArg.value = "1.0";
+  scaleArg.name = "Scale";
+  scaleArg.description = "Scale applied before conversion, or auto";
+  scaleArg.type = SoapySDR::ArgInfo::STRING;
+  streamArgs.push_back(scaleArg);
+
+  // Digital AGC, replaces the scale. Its gain is reported like the scale.
+  SoapySDR::ArgInfo agcArg;
+  agcArg.key = "agc";
+  agcArg.value = "false";
+  agcArg.name = "Digital AGC";
+  agcArg.description = "Normalise the level of this stream";
+  agcArg.type = SoapySDR::ArgInfo::BOOL;
+  streamArgs.push_back(agcArg);
+
+  SoapySDR::ArgInfo agcLevelArg;
+  agcLevelArg.key = "agc_level";
+  agcLevelArg.value = "-20";
+  agcLevelArg.name = "AGC level";
+  agcLevelArg.description = "RMS level the digital AGC aims for";
+  agcLevelArg.units = "dBFS";
+  agcLevelArg.type = SoapySDR::ArgInfo::FLOAT;
+  agcLevelArg.range = SoapySDR::Range(-60, 0);
+  streamArgs.push_back(agcLevelArg);
+
+  SoapySDR::ArgInfo agcAttackArg;
+  agcAttackArg.key = "agc_attack";
+  agcAttackArg.value = "10";
+  agcAttackArg.name = "AGC attack";
+  agcAttackArg.description = "Time constant of falling digital AGC gain";
+  agcAttackArg.units = "ms";
+  agcAttackArg.type = SoapySDR::ArgInfo::FLOAT;
+  streamArgs.push_back(agcAttackArg);
+
+  SoapySDR::ArgInfo agcDecayArg;
+  agcDecayArg.key = "agc_decay";
+  agcDecayArg.value = "500";
+  agcDecayArg.name = "AGC decay";
+  agcDecayArg.description = "Time constant of rising digital AGC gain";
+  agcDecayArg.units = "ms";
+  agcDecayArg.type = SoapySDR::ArgInfo::FLOAT;
+  streamArgs.push_back(agcDecayArg);
+
+  // Needs a passband response for the sample rate, see the equaliser device
+  // arg.
+  SoapySDR::ArgInfo equaliseArg;
+  equaliseArg.key = "equalise";
+  equaliseArg.value = "false";
+  equaliseArg.name = "Equalise";
+  equaliseArg.description = "Flatten the passband with a short FIR";
+  equaliseArg.type = SoapySDR::ArgInfo::BOOL;
+  streamArgs.push_back(equaliseArg);
+
+  // Start the device at setup, activation only starts delivery.
+  SoapySDR::ArgInfo prewarmArg;
+  prewarmArg.key = "prewarm";
+  prewarmArg.value = "false";
+  prewarmArg.name = "Prewarm";
+  prewarmArg.description = "Start the device at setup so that activation "
+                           "delivers samples at once";
+  prewarmArg.type = SoapySDR::ArgInfo::BOOL;
+  streamArgs.push_back(prewarmArg);
+
+  // Samples disturbed by retunes, gain and rate changes, from the settling
+  // table in Settling.hpp.
+  SoapySDR::ArgInfo settleArg;
+  settleArg.key = "settle";
+  settleArg.value = "off";
+  settleArg.name = "Settling";
+  settleArg.description = "Pass, flag (AIRSPYHF_SETTLING) or drop samples "
+                          "disturbed by control changes";
+  settleArg.type = SoapySDR::ArgInfo::STRING;
+  settleArg.options = {"off", "mark", "discard"};
+  settleArg.optionNames = {"Off", "Mark", "Discard"};
+  streamArgs.push_back(settleArg);
+
+  // Eventfd for reading many streams from one thread, see AsyncRead.hpp.
+  SoapySDR::ArgInfo readyFdArg;
+  readyFdArg.key = "ready_fd";
+  readyFdArg.value = "-1";
+  readyFdArg.name = "Ready fd";
+  readyFdArg.description = "Eventfd signalled when a timed out "
+                           "non-blocking read can go on";
+  readyFdArg.type = SoapySDR::ArgInfo::INT;
+  streamArgs.push_back(readyFdArg);
+
   return streamArgs;
 }
 
 // Static trampoline for libairspyhf callback
-static int rx_callback_(airspyhf_transfer_t *transfer) {
-  // Stream handle
-  SoapySDR::Stream *stream = (SoapySDR::Stream *)transfer->ctx;
+int SoapyAirspyHF::rxCallback(airspyhf_transfer_t *transfer) {
+  // Device handle
+  SoapyAirspyHF *self = static_cast<SoapyAirspyHF *>(transfer->ctx);
 
   const uint32_t timeout_us = 500'000; // 500ms
+  const auto sample_count = static_cast<size_t>(transfer->sample_count);
+
+  // I or Q at this level is taken as clipped, the ADC saturates just below
+  // 1.0.
+  const float clip_level = 0.99f;
+
+  if (self->watchdog_) {
+    self->watchdog_->transfer();
+  }
+
+  // Arrival against the stream time of the last sample. USB only adds
+  // delay, so follow the least delayed transfers and rise slowly for
+  // clock drift.
+  const long long arrivedNs =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count();
+  const long long offsetNs =
+      arrivedNs - self->writeTimeNs() -
+      SoapySDR::ticksToTimeNs(static_cast<long long>(sample_count) +
+                                  transfer->dropped_samples,
+                              self->state().sampleRate);
+  const long long hostOffsetNs =
+      self->hostOffsetNs_.load(std::memory_order_relaxed);
+  self->hostOffsetNs_.store(offsetNs < hostOffsetNs
+                                ? offsetNs
+                                : hostOffsetNs + (offsetNs - hostOffsetNs) / 64,
+                            std::memory_order_relaxed);
+
+  // Keep the timeline intact for samples we lost.
+  const auto skipTicks = [self](const long long lost) {
+    const auto offset =
+        self->tickOffset_.fetch_add(lost, std::memory_order_release) + lost;
+    if (self->export_) {
+      self->export_->control().tick_offset.store(offset,
+                                                 std::memory_order_release);
+    }
+  };
+
+  // Soft paused, nobody reads. Keep the timeline going without writing.
+  if (self->paused_.load(std::memory_order_acquire)) {
+    skipTicks(static_cast<long long>(sample_count + transfer->dropped_samples));
+    return 0;
+  }
+
+  // Time to first sample, see the startup setting.
+  if (self->awaitingTransfer_.load(std::memory_order_relaxed) and
+      self->awaitingTransfer_.exchange(false)) {
+    self->firstTransferMs_ = std::chrono::duration<double, std::milli>(
+                                 std::chrono::steady_clock::now() -
+                                 self->startedAt_)
+                                 .count();
+  }
+
+  // Lost before this transfer, skipped before writing it so that readers
+  // getting it see the jump in time.
+  if (transfer->dropped_samples > 0) {
+    skipTicks(static_cast<long long>(transfer->dropped_samples));
+  }
 
-  const auto written = stream->ringbuffer().write_at_least(
-      static_cast<size_t>(transfer->sample_count),
-      std::chrono::microseconds(timeout_us),
+  BlockStats stats;
+  const auto written = self->ringbuffer_.write_at_least(
+      sample_count, std::chrono::microseconds(timeout_us),
       [&](airspyhf_complex_float_t *begin,
-          [[maybe_unused]] const uint32_t available) {
+          [[maybe_unused]] const size_t available) {
         // Copy samples to ringbuffer, conversion is done in readStream if
-        // needed.
-        std::copy(transfer->samples, transfer->samples + transfer->sample_count,
-                  begin);
+        // needed. Measure them on the way.
+        stats = copyCF32WithStats(transfer->samples, begin, sample_count,
+                                  clip_level);
 
-        return transfer->sample_count;
+        return sample_count;
       });
 
-  // Add ticks
-  stream->addTicks(transfer->sample_count);
+  if (written >= 0) {
+    std::unique_lock<std::mutex> lock(self->statsLock_);
+    self->lastStats_ = stats;
+    self->clippedTotal_ += stats.clipped;
+    self->level_.update(
+        reinterpret_cast<const std::complex<float> *>(transfer->samples),
+        stats, self->state().sampleRate);
+    if (self->gainSupervisor_) {
+      self->gainSupervisor_->update(stats);
+    }
+  }
 
   if (written < 0) {
+    skipTicks(static_cast<long long>(sample_count));
     SoapySDR::logf(SOAPY_SDR_INFO,
                    "SoapyAirspyHF::rx_callback: ringbuffer write timeout");
     return 0;
@@ -133,17 +325,42 @@ static int rx_callback_(airspyhf_transfer_t *transfer) {
  * Stream API
  ******************************************************************/
 
+// Numeric stream arg, or its default.
+static double streamArg(const SoapySDR::Kwargs &args, const std::string &key,
+                        const double value) {
+  if (not args.count(key)) {
+    return value;
+  }
+  try {
+    return std::stod(args.at(key));
+  } catch (const std::exception &) {
+    throw std::runtime_error("setupStream invalid " + key + " '" +
+                             args.at(key) + "'.");
+  }
+}
+
+// Add value to a ready fd, if the stream has one.
+static void signalReady(const int fd, const uint64_t value) {
+  if (fd < 0) {
+    return;
+  }
+  if (write(fd, &value, sizeof(value)) != sizeof(value)) {
+    SoapySDR::logf(SOAPY_SDR_ERROR, "Could not signal ready_fd: %s",
+                   strerror(errno));
+  }
+}
+
 SoapySDR::Stream *
 SoapyAirspyHF::setupStream(const int direction, const std::string &format,
                            const std::vector<size_t> &channels,
                            const SoapySDR::Kwargs &args) {
 
-  (void)args; // Currently unused
+  const auto sampleRate = state().sampleRate;
 
-  SoapySDR::logf(SOAPY_SDR_DEBUG, "setupStream(%d, %s, %d, %f)", direction,
-                 format.c_str(), channels.size(), sampleRate_);
+  SoapySDR::logf(SOAPY_SDR_DEBUG, "setupStream(%d, %s, %d, %u)", direction,
+                 format.c_str(), channels.size(), sampleRate);
 
-  assert(sampleRate_ > 0);
+  assert(sampleRate > 0);
 
   if (direction != SOAPY_SDR_RX or channels.size() != 1 or
       channels.at(0) != 0) {
@@ -152,29 +369,125 @@ SoapyAirspyHF::setupStream(const int direction, const std::string &format,
                    direction, format.c_str(), channels.size(), channels.at(0));
   }
 
-  const auto &sources = SoapySDR::ConverterRegistry::listSourceFormats(format);
+  SoapySDR::ConverterRegistry::ConverterFunction converterFunction;
+
+  if (format == SOAPY_SDR_CS12) {
+    converterFunction = convertCF32toCS12Dither;
+  } else if (format == SOAPY_SDR_CS8) {
+    converterFunction = convertCF32toCS8Dither;
+  } else {
+    const auto &sources =
+        SoapySDR::ConverterRegistry::listSourceFormats(format);
+
+    // Check there is a convert function that can convert from our native
+    // format.
+    if (std::find(sources.begin(), sources.end(), AIRSPYHF_NATIVE_FORMAT) ==
+        sources.end()) {
+      throw std::runtime_error("setupStream invalid format '" + format + "'.");
+    }
+
+    // Find converter function
+    converterFunction = SoapySDR::ConverterRegistry::getFunction(
+        AIRSPYHF_NATIVE_FORMAT, format, SoapySDR::ConverterRegistry::GENERIC);
+  }
+
+  // Overflow policy
+  bool blocking = true;
+  if (args.count("overflow")) {
+    const auto &overflow = args.at("overflow");
+    if (overflow == "drop") {
+      blocking = false;
+    } else if (overflow != "block") {
+      throw std::runtime_error("setupStream invalid overflow '" + overflow +
+                               "'.");
+    }
+  }
+
+  // Settling policy
+  auto settle = SoapySDR::Stream::Settle::Off;
+  if (args.count("settle")) {
+    const auto &value = args.at("settle");
+    if (value == "mark") {
+      settle = SoapySDR::Stream::Settle::Mark;
+    } else if (value == "discard") {
+      settle = SoapySDR::Stream::Settle::Discard;
+    } else if (value != "off") {
+      throw std::runtime_error("setupStream invalid settle '" + value + "'.");
+    }
+  }
+
+  const double readyFd = streamArg(args, "ready_fd", -1);
+  if (readyFd != std::floor(readyFd) or readyFd < -1 or
+      readyFd > std::numeric_limits<int>::max()) {
+    throw std::runtime_error("setupStream invalid ready_fd '" +
+                             args.at("ready_fd") + "'.");
+  }
 
-  // Check there is a convert function that can convert from our native format.
-  if (std::find(sources.begin(), sources.end(), AIRSPYHF_NATIVE_FORMAT) ==
-      sources.end()) {
-    throw std::runtime_error("setupStream invalid format '" + format + "'.");
+  // Scale, auto starts at unity and adapts from the first block.
+  const bool autoScale = args.count("scale") and args.at("scale") == "auto";
+  const double scale = autoScale ? 1.0 : streamArg(args, "scale", 1.0);
+
+  // Digital AGC, time constants in ms
+  std::unique_ptr<DigitalAgc> agc;
+  if (args.count("agc") and args.at("agc") == "true") {
+    agc = std::make_unique<DigitalAgc>(
+        streamArg(args, "agc_level", -20),
+        streamArg(args, "agc_attack", 10) / 1e3,
+        streamArg(args, "agc_decay", 500) / 1e3);
   }
 
-  // Find converter function
-  const auto converterFunction = SoapySDR::ConverterRegistry::getFunction(
-      AIRSPYHF_NATIVE_FORMAT, format, SoapySDR::ConverterRegistry::GENERIC);
+  // Passband equaliser for the current sample rate
+  std::unique_ptr<FirEqualiser> equaliser;
+  if (args.count("equalise") and args.at("equalise") == "true") {
+    const auto *response =
+        passband_ ? passband_->response(sampleRate) : nullptr;
+    if (response == nullptr) {
+      throw std::runtime_error("setupStream no passband response for " +
+                               std::to_string(sampleRate) + " Hz.");
+    }
+    equaliser = std::make_unique<FirEqualiser>(*response);
+  }
 
-  SoapySDR::logf(SOAPY_SDR_INFO, "setupStream: format=%s", format.c_str());
+  SoapySDR::logf(SOAPY_SDR_INFO,
+                 "setupStream: format=%s, overflow=%s, scale=%s",
+                 format.c_str(), blocking ? "block" : "drop",
+                 agc         ? "agc"
+                 : autoScale ? "auto"
+                             : std::to_string(scale).c_str());
 
   // Get MTU
-  const auto mtu = airspyhf_get_output_size(device_);
+  const int output_size = usb(airspyhf_get_output_size);
+  if (output_size <= 0) {
+    throw std::runtime_error("setupStream device not available.");
+  }
+  const auto mtu = static_cast<size_t>(output_size);
 
-  // Create stream;
-  stream_ = std::make_unique<SoapySDR::Stream>(device_, sampleRate_,
-                                               converterFunction, mtu);
+  std::unique_lock<std::mutex> lock(streamsLock_);
+
+  if (streams_.size() >= SampleRingBuffer::max_readers) {
+    throw std::runtime_error("setupStream too many streams.");
+  }
+
+  // Create stream
+  const bool prewarm = args.count("prewarm") and args.at("prewarm") == "true";
+  streams_.push_back(std::make_unique<SoapySDR::Stream>(
+      sampleRate, format, converterFunction, mtu, blocking, scale,
+      autoScale, std::move(agc), std::move(equaliser), prewarm, settle,
+      static_cast<int>(readyFd)));
+
+  // Run the device already, dropping samples until a stream is activated.
+  if (prewarm and not started_) {
+    paused_ = true;
+    const int ret = startDevice();
+    if (ret != AIRSPYHF_SUCCESS) {
+      SoapySDR::logf(SOAPY_SDR_WARNING,
+                     "setupStream: prewarm airspyhf_start failed: %d", ret);
+      paused_ = false;
+    }
+  }
 
   // Return point to stream
-  return stream_.get();
+  return streams_.back().get();
 }
 
 void SoapyAirspyHF::closeStream(SoapySDR::Stream *stream) {
@@ -182,13 +495,29 @@ void SoapyAirspyHF::closeStream(SoapySDR::Stream *stream) {
   // Log debug
   SoapySDR::logf(SOAPY_SDR_DEBUG, "closeStream");
 
-  // Check that stream is current
-  if (stream != stream_.get()) {
+  std::unique_lock<std::mutex> lock(streamsLock_);
+
+  const auto it = std::find_if(
+      streams_.begin(), streams_.end(),
+      [stream](const auto &candidate) { return candidate.get() == stream; });
+
+  // Check that stream belongs to us before touching it
+  if (it == streams_.end()) {
     SoapySDR::logf(SOAPY_SDR_ERROR, "closeStream: invalid stream");
     return;
   }
 
-  stream_.reset();
+  // Stop delivering to the stream before it's gone.
+  deactivate(stream);
+
+  // Fail reads waiting on the ready fd without touching the stream.
+  signalReady(stream->readyFd(), AIRSPYHF_READY_CLOSED);
+  streams_.erase(it);
+
+  // The last prewarmed stream without active ones
+  if (started_ and activeStreams_ == 0 and not keepRunning()) {
+    stopDevice();
+  }
 }
 
 size_t SoapyAirspyHF::getStreamMTU(SoapySDR::Stream *stream) const {
@@ -214,18 +543,30 @@ int SoapyAirspyHF::activateStream(SoapySDR::Stream *stream, const int flags,
     SoapySDR::logf(SOAPY_SDR_WARNING, "activateStream: flags not supported");
   }
 
-  // Clear buffer
-  stream->ringbuffer().clear();
-  // Reset ticks
-  stream->ticks_ = 0;
+  std::unique_lock<std::mutex> lock(streamsLock_);
 
-  // Start the stream
-  ret = airspyhf_start(device_, &rx_callback_, static_cast<void *>(stream));
-  if (ret != AIRSPYHF_SUCCESS) {
-    SoapySDR::logf(SOAPY_SDR_ERROR, "activateStream: airspyhf_start failed: %d",
-                   ret);
-    return SOAPY_SDR_STREAM_ERROR;
+  if (stream->active()) {
+    return 0;
+  }
+
+  // Start reading from the newest sample
+  stream->reader() = ringbuffer_.add_reader(stream->blocking());
+
+  // Start the device for the first active stream, unless soft paused.
+  if (not started_) {
+    startedAt_ = std::chrono::steady_clock::now();
+    awaitingTransfer_ = true;
+    ret = startDevice();
+    if (ret != AIRSPYHF_SUCCESS) {
+      SoapySDR::logf(SOAPY_SDR_ERROR,
+                     "activateStream: airspyhf_start failed: %d", ret);
+      stream->reader().release();
+      return SOAPY_SDR_STREAM_ERROR;
+    }
   }
+  paused_ = false;
+
+  activeStreams_++;
 
   SoapySDR::logf(SOAPY_SDR_DEBUG,
                  "activateStream: flags=%d, timeNs=%lld, numElems=%d", flags,
@@ -236,8 +577,6 @@ int SoapyAirspyHF::activateStream(SoapySDR::Stream *stream, const int flags,
 
 int SoapyAirspyHF::deactivateStream(SoapySDR::Stream *stream, const int flags,
                                     const long long timeNs) {
-  int ret = 0;
-
   SoapySDR::logf(SOAPY_SDR_DEBUG, "deactivateStream: flags=%d, timeNs=%lld",
                  flags, timeNs);
 
@@ -245,17 +584,78 @@ int SoapyAirspyHF::deactivateStream(SoapySDR::Stream *stream, const int flags,
     SoapySDR::logf(SOAPY_SDR_DEBUG, "deactivateStream: flags not supported");
   }
 
-  // Stop streaming
-  ret = airspyhf_stop(stream->device());
-  if (ret != AIRSPYHF_SUCCESS) {
-    SoapySDR::logf(SOAPY_SDR_ERROR,
-                   "deactivateStream: airspyhf_stop() failed: %d", ret);
-    return SOAPY_SDR_STREAM_ERROR;
+  std::unique_lock<std::mutex> lock(streamsLock_);
+  return deactivate(stream);
+}
+
+int SoapyAirspyHF::deactivate(SoapySDR::Stream *stream) {
+  int ret = 0;
+
+  if (not stream->active()) {
+    return 0;
+  }
+
+  // Stop holding back the other streams
+  stream->reader().release();
+  activeStreams_--;
+
+  // Waiting non-blocking reads retry and fail.
+  signalReady(stream->readyFd(), 1);
+
+  // Stop streaming when the last stream is deactivated, or only stop
+  // writing samples with soft pause.
+  if (activeStreams_ == 0 and keepRunning()) {
+    paused_ = true;
+  } else if (activeStreams_ == 0) {
+    ret = stopDevice();
+    if (ret != AIRSPYHF_SUCCESS) {
+      SoapySDR::logf(SOAPY_SDR_ERROR,
+                     "deactivateStream: airspyhf_stop() failed: %d", ret);
+      return SOAPY_SDR_STREAM_ERROR;
+    }
   }
 
   return 0;
 }
 
+int SoapyAirspyHF::startDevice() {
+  const int ret = usb(airspyhf_start, &rxCallback, static_cast<void *>(this));
+  if (ret == AIRSPYHF_SUCCESS) {
+    started_ = true;
+    if (watchdog_) {
+      watchdog_->streaming(true);
+    }
+  }
+  return ret;
+}
+
+bool SoapyAirspyHF::keepRunning() const {
+  return softPause_ or
+         std::any_of(streams_.begin(), streams_.end(),
+                     [](const auto &stream) { return stream->prewarm(); });
+}
+
+int SoapyAirspyHF::stopDevice() {
+  if (watchdog_) {
+    watchdog_->streaming(false);
+  }
+  started_ = false;
+  paused_ = false;
+  return usb(airspyhf_stop);
+}
+
+void SoapyAirspyHF::settle(const size_t from, const Settling::Change change,
+                           const double step) {
+  // The transfer being filled when the change arrived is disturbed too.
+  const int transfer = usb(airspyhf_get_output_size);
+  const size_t to = ringbuffer_.write_position() +
+                    settling_.samples(change, step, state().sampleRate) +
+                    static_cast<size_t>(std::max(transfer, 0));
+
+  std::unique_lock<std::mutex> lock(stateLock_);
+  settling_.add(from, to);
+}
+
 int SoapyAirspyHF::readStream(SoapySDR::Stream *stream, void *const *buffs,
                               const size_t numElems, int &flags,
                               long long &timeNs, const long timeoutUs) {
@@ -264,29 +664,255 @@ int SoapyAirspyHF::readStream(SoapySDR::Stream *stream, void *const *buffs,
   SoapySDR::logf(SOAPY_SDR_DEBUG, "readStream: numElems=%d, timeoutUs=%ld",
                  numElems, timeoutUs);
 
-  // Flags are not used by this driver
   flags = 0;
 
-  // Convert either requested number of elements or the MTU.
-  const auto to_convert = std::min(numElems, getStreamMTU(stream));
+  if (not stream->active()) {
+    SoapySDR::logf(SOAPY_SDR_ERROR, "readStream: stream not active.");
+    return SOAPY_SDR_STREAM_ERROR;
+  }
+
+  auto &reader = stream->reader();
+  auto position = reader.position();
+
+  // Non-blocking reads of streams with a ready fd signal it when required
+  // samples are there.
+  const auto timedOut = [&](const size_t required) {
+    if (timeoutUs != 0 or stream->readyFd() < 0) {
+      SoapySDR::logf(SOAPY_SDR_INFO, "readStream: ringbuffer read timeout.");
+      return SOAPY_SDR_TIMEOUT;
+    }
+    // The fd, the stream may be gone when the producer fires.
+    const int fd = stream->readyFd();
+    if (not reader.notify_when_available(required,
+                                         [fd] { signalReady(fd, 1); })) {
+      signalReady(fd, 1);
+    }
+    return SOAPY_SDR_TIMEOUT;
+  };
+
+  // Samples disturbed by a control change, the equaliser spreads them
+  // over its taps.
+  const auto transient = [&] {
+    auto next = settling_.next(position);
+    if (next.from != next.to) {
+      next.to += 2 * stream->delay();
+    }
+    return next;
+  };
+  auto disturbed = transient();
+
+  while (stream->settle() == SoapySDR::Stream::Settle::Discard and
+         disturbed.from <= position and position < disturbed.to) {
+    const auto skipped = reader.read_at_least(
+        1, std::chrono::microseconds(timeoutUs),
+        [&]([[maybe_unused]] const airspyhf_complex_float_t *begin,
+            const size_t available) {
+          return std::min(available, disturbed.to - position);
+        });
+    if (skipped == SampleRingBuffer::read_overrun) {
+      SoapySDR::logf(SOAPY_SDR_INFO, "readStream: overflow.");
+      return SOAPY_SDR_OVERFLOW;
+    }
+    if (skipped < 0) {
+      return timedOut(1);
+    }
+    position = reader.position();
+    disturbed = transient();
+  }
+
+  // Rate of the first sample, and where it changes.
+  size_t end;
+  const auto segment = timeline_.at(position, end);
+
+  // Convert either requested number of elements or the MTU, but not past
+  // a sample rate change or into or out of a transient.
+  auto to_convert = std::min({numElems, getStreamMTU(stream), end - position});
+  bool settling = false;
+  if (stream->settle() != SoapySDR::Stream::Settle::Off and
+      disturbed.from != disturbed.to) {
+    if (position < disturbed.from) {
+      to_convert = std::min(to_convert, disturbed.from - position);
+    } else {
+      to_convert = std::min(to_convert, disturbed.to - position);
+      settling = true;
+    }
+  }
 
-  const auto converted = stream->ringbuffer().read_at_least(
+  const auto converted = reader.read_at_least(
       to_convert, std::chrono::microseconds(timeoutUs),
       [&](const airspyhf_complex_float_t *begin,
-          [[maybe_unused]] const uint32_t available) {
+          [[maybe_unused]] const size_t available) {
+        // Timed once the samples are there, so that a gap before them has
+        // moved the tick offset.
+        timeNs = Timeline::time(segment, position,
+                                tickOffset_.load(std::memory_order_acquire) -
+                                    static_cast<long long>(stream->delay()));
+
         // Convert samples to output buffer
-        stream->converter()(begin, buffs[0], to_convert, 1.0);
+        stream->convert(begin, buffs[0], to_convert);
 
         // Consume from ringbuffer
         return to_convert;
       });
 
-  timeNs = stream->timeNs();
+  if (converted == SampleRingBuffer::read_overrun) {
+    SoapySDR::logf(SOAPY_SDR_INFO, "readStream: overflow.");
+    return SOAPY_SDR_OVERFLOW;
+  }
 
   if (converted < 0) {
-    SoapySDR::logf(SOAPY_SDR_INFO, "readStream: ringbuffer read timeout.");
-    return SOAPY_SDR_TIMEOUT;
+    return timedOut(to_convert);
+  }
+
+  if (settling) {
+    flags |= AIRSPYHF_SETTLING;
   }
 
   return static_cast<int>(converted);
 }
+
+int SoapyAirspyHF::readStreamStatus(SoapySDR::Stream *stream, size_t &chanMask,
+                                    int &flags, long long &timeNs,
+                                    const long timeoutUs) {
+
+  // Log debug
+  SoapySDR::logf(SOAPY_SDR_DEBUG, "readStreamStatus: timeoutUs=%ld",
+                 timeoutUs);
+
+  SoapySDR::Stream::Event event;
+  if (not stream->popEvent(event, std::chrono::microseconds(timeoutUs))) {
+    return SOAPY_SDR_TIMEOUT;
+  }
+
+  chanMask = 1;
+  flags = SOAPY_SDR_HAS_TIME | event.flags;
+  timeNs = event.timeNs;
+
+  return 0;
+}
+
+bool SoapyAirspyHF::recover(const Watchdog::Clock::duration gap) {
+  const auto began = Watchdog::Clock::now();
+
+  // Activation and deactivation wait, so do setters needing the device.
+  std::unique_lock<std::mutex> streamsLock(streamsLock_);
+  if (not started_) {
+    return true;
+  }
+  std::unique_lock<std::mutex> lock(usbLock_);
+
+  if (device_) {
+    SoapySDR::logf(SOAPY_SDR_WARNING,
+                   "No transfers for %lld ms, reopening the device",
+                   static_cast<long long>(
+                       std::chrono::duration_cast<std::chrono::milliseconds>(
+                           gap)
+                           .count()));
+    airspyhf_stop(device_);
+    airspyhf_close(device_);
+    device_ = nullptr;
+  }
+
+  // By serial, the first device is not necessarily this one. The serial
+  // is read at open when not given, left 0 (no device) if that failed.
+  airspyhf_device_t *device = nullptr;
+  int ret = airspyhf_open_sn(&device, serial_);
+  if (ret != AIRSPYHF_SUCCESS) {
+    SoapySDR::logf(SOAPY_SDR_DEBUG, "recover: open failed: %d", ret);
+    return false;
+  }
+
+  // The settings as the getters report them.
+  const auto state = this->state();
+  airspyhf_set_samplerate(device, state.sampleRate);
+  airspyhf_set_lib_dsp(device, state.enableDSP);
+  airspyhf_set_calibration(device,
+                           static_cast<int32_t>(state.frequencyCorrection +
+                                                state.calibrationPpb));
+  airspyhf_set_hf_agc(device, state.agcEnabled);
+  airspyhf_set_hf_lna(device, state.lnaGain > 3 ? 1 : 0);
+  airspyhf_set_hf_att(
+      device, static_cast<uint8_t>(std::round(state.hfAttenuation / -6)));
+  airspyhf_set_freq(device, state.centerFrequency);
+  if (calibration_) {
+    airspyhf_set_optimal_iq_correction_point(
+        device, static_cast<float>(state.calibrationIqPoint));
+  }
+
+  // Count the samples missed as received so timestamps jump the gap.
+  const double outage =
+      std::chrono::duration<double>(gap + (Watchdog::Clock::now() - began))
+          .count();
+  const auto lost = static_cast<long long>(outage * state.sampleRate);
+  const auto offset =
+      tickOffset_.fetch_add(lost, std::memory_order_release) + lost;
+  const auto position = ringbuffer_.write_position();
+  const long long ticks = static_cast<long long>(position) + offset;
+  const long long timeNs = writeTimeNs();
+
+  ret = airspyhf_start(device, &rxCallback, static_cast<void *>(this));
+  if (ret != AIRSPYHF_SUCCESS) {
+    SoapySDR::logf(SOAPY_SDR_DEBUG, "recover: start failed: %d", ret);
+    tickOffset_.fetch_sub(lost, std::memory_order_release);
+    airspyhf_close(device);
+    return false;
+  }
+  device_ = device;
+  lock.unlock();
+
+  // Restarted from scratch, like after a rate change.
+  tunedFrequency_ = state.centerFrequency;
+  settle(position, Settling::Change::Rate);
+
+  if (export_) {
+    export_->control().tick_offset.store(offset, std::memory_order_release);
+  }
+
+  SoapySDR::logf(SOAPY_SDR_WARNING,
+                 "Device reopened after %.1f s, samples resume at tick %lld",
+                 outage, ticks);
+
+  for (auto &stream : streams_) {
+    if (stream->active()) {
+      stream->pushEvent({timeNs, AIRSPYHF_RECONNECTED});
+    }
+  }
+  return true;
+}
+
+void SoapyAirspyHF::stopGainSupervisor(const char *caller) {
+  // Swap under the lock, destroy (join) outside it.
+  std::unique_ptr<GainSupervisor> supervisor;
+  {
+    std::unique_lock<std::mutex> lock(statsLock_);
+    gainSupervisor_.swap(supervisor);
+  }
+  if (supervisor) {
+    SoapySDR::logf(SOAPY_SDR_WARNING,
+                   "%s: manual gain change, gain supervisor disabled", caller);
+  }
+}
+
+void SoapyAirspyHF::applySupervisedGain(const double lna, const double att) {
+  // Directly, not through the control queue, so the tick below follows
+  // the change.
+  applyGain("LNA", lna);
+  applyGain("HF_ATT", att);
+
+  // Next sample written, the first that can have the new gain.
+  const long long ticks =
+      static_cast<long long>(ringbuffer_.write_position()) +
+      tickOffset_.load(std::memory_order_acquire);
+  const long long timeNs = writeTimeNs();
+
+  SoapySDR::logf(SOAPY_SDR_INFO,
+                 "Gain supervisor: LNA=%.0f dB, HF_ATT=%.0f dB at tick %lld",
+                 lna, att, ticks);
+
+  std::unique_lock<std::mutex> lock(streamsLock_);
+  for (auto &stream : streams_) {
+    if (stream->active()) {
+      stream->pushEvent({timeNs, AIRSPYHF_GAIN_CHANGED});
+    }
+  }
+}
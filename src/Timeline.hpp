@@ -0,0 +1,96 @@
+// Copyright 2024 SM6WJM
+
+#pragma once
+
+#include <SoapySDR/Time.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+#include "SeqLock.hpp"
+
+// Sample rate history of the ring buffer. A segment starts at a ring
+// position where the rate changed, samples in it are timed from its start
+// at its rate. Readers lagging behind a change still find the rate their
+// samples were received with, as long as they are within the last
+// `history` changes.
+class Timeline {
+public:
+  struct Segment {
+    // Ring position and tick offset at the start, and the time of the
+    // first sample in ns.
+    size_t position;
+    long long tickOffset;
+    long long timeNs;
+    double rate;
+  };
+
+  static constexpr size_t history = 4;
+
+  // Samples from position on are at rate. Changes are serialised by the
+  // caller.
+  void change(const size_t position, const long long tickOffset,
+              const double rate) {
+    auto segments = segments_.load();
+
+    if (segments.count > 0) {
+      auto &last = segments.list.at((segments.count - 1) % history);
+      // Nothing received since the last change, only the rate changed.
+      if (last.position == position) {
+        last.rate = rate;
+        segments_.store(segments);
+        return;
+      }
+      const Segment next = {position, tickOffset,
+                            time(last, position, tickOffset), rate};
+      segments.list.at(segments.count % history) = next;
+    } else {
+      segments.list.at(0) = {position, tickOffset,
+                        SoapySDR::ticksToTimeNs(
+                            static_cast<long long>(position) + tickOffset,
+                            rate),
+                        rate};
+    }
+    segments.count++;
+    segments_.store(segments);
+  }
+
+  // Segment of the sample at position, and where the next segment starts.
+  Segment at(const size_t position, size_t &end) const {
+    const auto segments = segments_.load();
+    end = std::numeric_limits<size_t>::max();
+
+    const size_t oldest =
+        segments.count > history ? segments.count - history : 0;
+    for (size_t i = segments.count; i > oldest; i--) {
+      const auto &segment = segments.list.at((i - 1) % history);
+      if (segment.position <= position or i - 1 == oldest) {
+        return segment;
+      }
+      end = segment.position;
+    }
+    return Segment{0, 0, 0, 0};
+  }
+
+  // Time of the sample at position, with the current tick offset.
+  static long long time(const Segment &segment, const size_t position,
+                        const long long tickOffset) {
+    if (segment.rate <= 0) {
+      return segment.timeNs;
+    }
+    return segment.timeNs +
+           SoapySDR::ticksToTimeNs(
+               static_cast<long long>(position - segment.position) +
+                   tickOffset - segment.tickOffset,
+               segment.rate);
+  }
+
+private:
+  struct Segments {
+    std::array<Segment, history> list;
+    size_t count;
+  };
+  SeqLock<Segments> segments_;
+};
@@ -0,0 +1,63 @@
+// Copyright 2024 SM6WJM
+
+#include "Watchdog.hpp"
+
+#include <SoapySDR/Logger.hpp>
+
+#include <exception>
+
+Watchdog::Watchdog(const std::chrono::milliseconds timeout, Recover recover)
+    : timeout_(timeout), recover_(std::move(recover)), running_(true),
+      streaming_(false), last_(0), recoveries_(0) {
+  thread_ = std::thread(&Watchdog::run, this);
+}
+
+Watchdog::~Watchdog() {
+  {
+    std::unique_lock<std::mutex> lock(lock_);
+    running_ = false;
+  }
+  wake_.notify_one();
+  thread_.join();
+}
+
+void Watchdog::streaming(const bool streaming) {
+  std::unique_lock<std::mutex> lock(lock_);
+  streaming_ = streaming;
+  // The first transfer takes a while
+  transfer();
+}
+
+void Watchdog::run() {
+  std::unique_lock<std::mutex> lock(lock_);
+
+  // Not before this, a failed attempt waits a timeout.
+  auto next = Clock::now();
+
+  while (running_) {
+    wake_.wait_for(lock, timeout_ / 4, [this] { return not running_; });
+
+    const auto now = Clock::now();
+    const auto gap = now - Clock::time_point(Clock::duration(
+                               last_.load(std::memory_order_relaxed)));
+    if (not running_ or not streaming_ or gap < timeout_ or now < next) {
+      continue;
+    }
+
+    // Without the lock, recover stops and starts the device.
+    lock.unlock();
+    bool recovered = false;
+    try {
+      recovered = recover_(gap);
+    } catch (const std::exception &e) {
+      SoapySDR::logf(SOAPY_SDR_ERROR, "Watchdog: %s", e.what());
+    }
+    lock.lock();
+
+    if (recovered) {
+      recoveries_.fetch_add(1, std::memory_order_relaxed);
+      transfer();
+    }
+    next = Clock::now() + timeout_;
+  }
+}
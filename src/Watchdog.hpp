@@ -0,0 +1,60 @@
+// Copyright 2024 SM6WJM
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Watches the rx callback. When the device is streaming but no transfer
+// came for the timeout, e.g. after a USB reset or a loose cable, it calls
+// recover, and again every timeout until that succeeds.
+class Watchdog {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  // Reopen and restart the device, gap is the time since the last
+  // transfer. True on success.
+  using Recover = std::function<bool(Clock::duration gap)>;
+
+  Watchdog(std::chrono::milliseconds timeout, Recover recover);
+  ~Watchdog();
+
+  Watchdog(const Watchdog &) = delete;
+  Watchdog &operator=(const Watchdog &) = delete;
+
+  // Called from the rx callback on every transfer.
+  void transfer() noexcept {
+    last_.store(Clock::now().time_since_epoch().count(),
+                std::memory_order_relaxed);
+  }
+
+  // The device was started or stopped.
+  void streaming(bool streaming);
+
+  // Successful recoveries
+  uint64_t recoveries() const {
+    return recoveries_.load(std::memory_order_relaxed);
+  }
+
+private:
+  const std::chrono::milliseconds timeout_;
+  Recover recover_;
+
+  std::mutex lock_;
+  std::condition_variable wake_;
+  bool running_;
+  bool streaming_;
+
+  // Last transfer, or start, in Clock ticks.
+  std::atomic<Clock::rep> last_;
+  std::atomic<uint64_t> recoveries_;
+
+  std::thread thread_;
+
+  void run();
+};
@@ -0,0 +1,100 @@
+// Copyright 2024 SM6WJM
+
+// Decode an IQZ recording to raw interleaved CF32, and report the
+// compression ratio and decoder throughput.
+//
+// Usage: airspyhf_iqz_decode input.iqz output.cf32
+
+#include "IqCodec.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <complex>
+#include <cstdio>
+#include <exception>
+#include <vector>
+
+int main(int argc, char *argv[]) {
+  if (argc != 3) {
+    std::fprintf(stderr, "Usage: %s input.iqz output.cf32\n", argv[0]);
+    return 1;
+  }
+
+  FILE *in = std::fopen(argv[1], "rb");
+  if (in == nullptr) {
+    std::perror(argv[1]);
+    return 1;
+  }
+
+  FILE *out = std::fopen(argv[2], "wb");
+  if (out == nullptr) {
+    std::perror(argv[2]);
+    std::fclose(in);
+    return 1;
+  }
+
+  IqzFileHeader header{};
+  if (std::fread(&header, sizeof(header), 1, in) != 1 or
+      header.magic != IqzFileHeader::magic_value) {
+    std::fprintf(stderr, "%s: not an IQZ file\n", argv[1]);
+    std::fclose(in);
+    std::fclose(out);
+    return 1;
+  }
+
+  std::fprintf(stderr, "Sample rate %.0f, frequency %.0f, %u bits\n",
+               header.sampleRate, header.centerFrequency, header.bits);
+
+  uint64_t total_samples = 0;
+  uint64_t total_bytes = sizeof(header);
+  std::chrono::nanoseconds decode_time(0);
+
+  // The headers come from the file, the codec rejects bad ones before
+  // they size the buffers.
+  try {
+    IqCodec codec(header.bits);
+    std::vector<uint8_t> payload;
+    std::vector<std::complex<float>> samples;
+
+    IqzBlockHeader block{};
+    while (std::fread(&block, sizeof(block), 1, in) == 1) {
+      IqCodec::check(block);
+      payload.resize(block.payloadBytes);
+      samples.resize(block.samples);
+      if (std::fread(payload.data(), 1, payload.size(), in) !=
+          payload.size()) {
+        std::fprintf(stderr, "Truncated block\n");
+        break;
+      }
+
+      const auto start = std::chrono::steady_clock::now();
+      codec.decode(block, payload.data(), samples.data());
+      decode_time += std::chrono::steady_clock::now() - start;
+
+      std::fwrite(samples.data(), sizeof(samples[0]), samples.size(), out);
+
+      total_samples += block.samples;
+      total_bytes += sizeof(block) + block.payloadBytes;
+    }
+  } catch (const std::exception &e) {
+    std::fprintf(stderr, "%s: %s\n", argv[1], e.what());
+    std::fclose(in);
+    std::fclose(out);
+    return 1;
+  }
+
+  std::fclose(in);
+  std::fclose(out);
+
+  const double seconds = std::chrono::duration<double>(decode_time).count();
+  const auto samples_d = static_cast<double>(total_samples);
+  const auto bytes_d = static_cast<double>(std::max<uint64_t>(total_bytes, 1));
+  std::fprintf(stderr,
+               "%llu samples, ratio %.2f (CF32), %.2f (CS16), "
+               "decode %.1f MS/s\n",
+               static_cast<unsigned long long>(total_samples),
+               8.0 * samples_d / bytes_d, 4.0 * samples_d / bytes_d,
+               seconds > 0 ? samples_d / seconds / 1e6 : 0.0);
+
+  return 0;
+}
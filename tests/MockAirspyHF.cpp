@@ -0,0 +1,262 @@
+// Copyright 2024 SM6WJM
+
+#include "MockAirspyHF.hpp"
+
+#include <libairspyhf/airspyhf.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr int transfer_size = 1024;
+constexpr std::array<uint32_t, 4> samplerates = {912000, 768000, 456000,
+                                                 192000};
+
+std::mutex lock;
+MockConfig config;
+std::set<uint64_t> opened;
+std::atomic<uint64_t> delivered{0};
+
+// Common time base of the simulated receivers.
+const auto epoch = std::chrono::steady_clock::now();
+
+uint64_t splitmix(uint64_t x) {
+  x += 0x9e3779b97f4a7c15;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+  return x ^ (x >> 31);
+}
+
+} // namespace
+
+struct airspyhf_device {
+  uint64_t serial;
+  size_t index;
+  MockConfig config;
+  uint32_t samplerate = samplerates.back();
+  std::atomic<bool> streaming{false};
+  std::thread producer;
+
+  void produce(airspyhf_sample_block_cb_fn callback, void *ctx) {
+    const auto started = std::chrono::steady_clock::now();
+    const double rate = samplerate;
+    // Samples of the common signal since the epoch.
+    auto n = static_cast<uint64_t>(
+        std::chrono::duration<double>(started - epoch).count() * rate);
+    const uint64_t lag = index * config.delay;
+
+    std::vector<airspyhf_complex_float_t> samples(transfer_size);
+    uint64_t dropped = 0;
+    for (uint64_t k = 0; streaming.load(); k++) {
+      if (config.realtime) {
+        std::this_thread::sleep_until(
+            started + std::chrono::duration<double>(
+                          static_cast<double>((k + 1) * transfer_size) / rate));
+      }
+
+      if (config.dropEvery > 0 and index == config.dropDevice and
+          k % config.dropEvery == config.dropEvery - 1) {
+        dropped += transfer_size;
+        n += transfer_size;
+        continue;
+      }
+
+      for (auto &sample : samples) {
+        const auto value = mock_airspyhf_reference(n++ - lag);
+        sample = {value.real(), value.imag()};
+      }
+      airspyhf_transfer_t transfer{this, ctx, samples.data(), transfer_size,
+                                   dropped};
+      dropped = 0;
+      callback(&transfer);
+      delivered.fetch_add(transfer_size, std::memory_order_relaxed);
+    }
+  }
+};
+
+void mock_airspyhf_configure(const MockConfig &value) {
+  std::unique_lock<std::mutex> guard(lock);
+  config = value;
+}
+
+uint64_t mock_airspyhf_serial(const size_t index) {
+  return 0x3952600000000001 + index;
+}
+
+std::complex<float> mock_airspyhf_reference(const uint64_t n) {
+  const uint64_t bits = splitmix(n);
+  const auto unit = [](const uint64_t value) {
+    return static_cast<float>(value & 0xffffff) / float(0x1000000) - 0.5f;
+  };
+  return {unit(bits), unit(bits >> 32)};
+}
+
+uint64_t mock_airspyhf_samples() { return delivered.load(); }
+
+extern "C" {
+
+void airspyhf_lib_version(airspyhf_lib_version_t *lib_version) {
+  *lib_version = {1, 6, 8};
+}
+
+int airspyhf_list_devices(uint64_t *serials, const int count) {
+  MockConfig current;
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    current = config;
+  }
+  const auto devices = static_cast<int>(current.devices);
+  std::this_thread::sleep_for(current.openDelay * devices);
+  if (serials == nullptr) {
+    return devices;
+  }
+  const int listed = std::min(count, devices);
+  for (int i = 0; i < listed; i++) {
+    serials[i] = mock_airspyhf_serial(static_cast<size_t>(i));
+  }
+  return listed;
+}
+
+int airspyhf_open_sn(airspyhf_device_t **device, const uint64_t serial) {
+  MockConfig current;
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    current = config;
+    const auto index = serial - mock_airspyhf_serial(0);
+    if (serial < mock_airspyhf_serial(0) or index >= config.devices or
+        not opened.insert(serial).second) {
+      return AIRSPYHF_ERROR;
+    }
+    *device = new airspyhf_device;
+    (*device)->serial = serial;
+    (*device)->index = index;
+    (*device)->config = current;
+  }
+  std::this_thread::sleep_for(current.openDelay);
+  return AIRSPYHF_SUCCESS;
+}
+
+int airspyhf_open(airspyhf_device_t **device) {
+  size_t devices = 0;
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    devices = config.devices;
+  }
+  for (size_t i = 0; i < devices; i++) {
+    if (airspyhf_open_sn(device, mock_airspyhf_serial(i)) ==
+        AIRSPYHF_SUCCESS) {
+      return AIRSPYHF_SUCCESS;
+    }
+  }
+  return AIRSPYHF_ERROR;
+}
+
+int airspyhf_close(airspyhf_device_t *device) {
+  airspyhf_stop(device);
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    opened.erase(device->serial);
+  }
+  delete device;
+  return AIRSPYHF_SUCCESS;
+}
+
+int airspyhf_get_output_size(airspyhf_device_t *) { return transfer_size; }
+
+int airspyhf_start(airspyhf_device_t *device,
+                   airspyhf_sample_block_cb_fn callback, void *ctx) {
+  if (device->streaming.exchange(true)) {
+    return AIRSPYHF_ERROR;
+  }
+  std::this_thread::sleep_for(device->config.startDelay);
+  device->producer =
+      std::thread(&airspyhf_device::produce, device, callback, ctx);
+  return AIRSPYHF_SUCCESS;
+}
+
+int airspyhf_stop(airspyhf_device_t *device) {
+  device->streaming = false;
+  if (device->producer.joinable()) {
+    device->producer.join();
+  }
+  return AIRSPYHF_SUCCESS;
+}
+
+int airspyhf_set_freq(airspyhf_device_t *, const uint32_t) {
+  return AIRSPYHF_SUCCESS;
+}
+
+int airspyhf_set_lib_dsp(airspyhf_device_t *, const uint8_t) {
+  return AIRSPYHF_SUCCESS;
+}
+
+int airspyhf_get_samplerates(airspyhf_device_t *, uint32_t *buffer,
+                             const uint32_t len) {
+  if (len == 0) {
+    *buffer = static_cast<uint32_t>(samplerates.size());
+    return AIRSPYHF_SUCCESS;
+  }
+  std::copy_n(samplerates.begin(), std::min<size_t>(len, samplerates.size()),
+              buffer);
+  return AIRSPYHF_SUCCESS;
+}
+
+int airspyhf_set_samplerate(airspyhf_device_t *device,
+                            const uint32_t samplerate) {
+  if (std::find(samplerates.begin(), samplerates.end(), samplerate) ==
+      samplerates.end()) {
+    return AIRSPYHF_ERROR;
+  }
+  device->samplerate = samplerate;
+  return AIRSPYHF_SUCCESS;
+}
+
+int airspyhf_get_calibration(airspyhf_device_t *, int32_t *ppb) {
+  *ppb = 0;
+  return AIRSPYHF_SUCCESS;
+}
+
+int airspyhf_set_calibration(airspyhf_device_t *, const int32_t) {
+  return AIRSPYHF_SUCCESS;
+}
+
+int airspyhf_set_optimal_iq_correction_point(airspyhf_device_t *,
+                                             const float) {
+  return AIRSPYHF_SUCCESS;
+}
+
+int airspyhf_board_partid_serialno_read(
+    airspyhf_device_t *device, airspyhf_read_partid_serialno_t *partid) {
+  partid->part_id = 0x6b;
+  partid->serial_no[0] = static_cast<uint32_t>(device->serial >> 32);
+  partid->serial_no[1] = static_cast<uint32_t>(device->serial);
+  partid->serial_no[2] = 0;
+  partid->serial_no[3] = 0;
+  return AIRSPYHF_SUCCESS;
+}
+
+int airspyhf_version_string_read(airspyhf_device_t *, char *version,
+                                 const uint8_t length) {
+  std::strncpy(version, "mock", length);
+  return AIRSPYHF_SUCCESS;
+}
+
+int airspyhf_set_hf_agc(airspyhf_device_t *, const uint8_t) {
+  return AIRSPYHF_SUCCESS;
+}
+
+int airspyhf_set_hf_att(airspyhf_device_t *, const uint8_t) {
+  return AIRSPYHF_SUCCESS;
+}
+
+int airspyhf_set_hf_lna(airspyhf_device_t *, const uint8_t) {
+  return AIRSPYHF_SUCCESS;
+}
+}
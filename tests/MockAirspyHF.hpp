@@ -0,0 +1,46 @@
+// Copyright 2024 SM6WJM
+
+// Simulated libairspyhf for running the driver without hardware, linked
+// instead of the real library by the tests and benchmarks.
+//
+// The devices receive one common noise signal, indexed by samples since a
+// shared epoch, so that device i delivers sample n of it as reference
+// sample n - i * delay. Transfers are paced at the sample rate, or
+// produced as fast as the driver takes them.
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <complex>
+
+struct MockConfig {
+  // Devices listed, see mock_airspyhf_serial().
+  size_t devices = 1;
+  // Time taken by airspyhf_open and airspyhf_open_sn. Listing opens every
+  // device, so it takes openDelay per device.
+  std::chrono::microseconds openDelay{0};
+  // Time taken by airspyhf_start.
+  std::chrono::microseconds startDelay{0};
+  // Pace transfers at the sample rate.
+  bool realtime = true;
+  // Samples device i lags the common signal, times i.
+  size_t delay = 0;
+  // Device dropping every dropEvery'th transfer, with dropped_samples set
+  // on the next one. 0 for none.
+  size_t dropDevice = 0;
+  size_t dropEvery = 0;
+};
+
+// Applies to devices opened after.
+void mock_airspyhf_configure(const MockConfig &config);
+
+// Serial of device index.
+uint64_t mock_airspyhf_serial(size_t index);
+
+// Sample n of the common signal.
+std::complex<float> mock_airspyhf_reference(uint64_t n);
+
+// Samples delivered by all devices.
+uint64_t mock_airspyhf_samples();
@@ -0,0 +1,173 @@
+// Copyright 2024 SM6WJM
+
+// Aggregate device of three simulated receivers, each one lagging the
+// previous by a number of samples, see MockAirspyHF.hpp. Checks that
+// after alignment every channel has the same sample at the same index,
+// also across reads that time out half way and are completed from the
+// carried samples, and with contiguous timestamps. Then one receiver
+// loses transfers, which must be reported as overflows and realigned.
+// The device is opened from a device string, as applications do.
+
+#include "Aggregate.hpp"
+#include "MockAirspyHF.hpp"
+
+#include <SoapySDR/Formats.hpp>
+#include <SoapySDR/Time.hpp>
+#include <SoapySDR/Types.hpp>
+
+#include <chrono>
+#include <complex>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <vector>
+
+namespace {
+
+constexpr size_t channels = 3;
+constexpr size_t delay = 37;
+constexpr size_t blocks = 200;
+// Aligning again after lost samples must be done by then.
+constexpr auto deadline = std::chrono::seconds(30);
+
+struct Result {
+  size_t blocks = 0;
+  size_t partial = 0;
+  size_t overflows = 0;
+  size_t mismatched = 0;
+  size_t gaps = 0;
+  size_t errors = 0;
+};
+
+std::string serials() {
+  std::stringstream list;
+  list << std::hex;
+  for (size_t i = 0; i < channels; i++) {
+    if (i > 0) {
+      list << SoapyAirspyHFAggregate::serial_separator;
+    }
+    list << mock_airspyhf_serial(i);
+  }
+  return list.str();
+}
+
+// Reads until overflows overflows and then count blocks arrived. Every
+// other read does not wait, so that some channels time out after others
+// returned samples.
+Result run(const MockConfig &config, const size_t count,
+           const size_t overflows) {
+  mock_airspyhf_configure(config);
+  SoapyAirspyHFAggregate device(
+      SoapySDR::KwargsFromString("driver=airspyhf,serial=" + serials()));
+  if (device.getNumChannels(SOAPY_SDR_RX) != channels) {
+    std::printf("  %zu channels from serial=%s\n",
+                device.getNumChannels(SOAPY_SDR_RX), serials().c_str());
+    Result result;
+    result.errors++;
+    return result;
+  }
+  auto *stream =
+      device.setupStream(SOAPY_SDR_RX, SOAPY_SDR_CF32, {0, 1, 2});
+  const size_t mtu = device.getStreamMTU(stream);
+  const double rate = device.getSampleRate(SOAPY_SDR_RX, 0);
+
+  std::vector<std::vector<std::complex<float>>> buffers(
+      channels, std::vector<std::complex<float>>(mtu));
+  std::vector<void *> buffs;
+  for (auto &buffer : buffers) {
+    buffs.push_back(buffer.data());
+  }
+
+  Result result;
+  device.activateStream(stream);
+  const auto began = std::chrono::steady_clock::now();
+  long long nextNs = 0;
+  bool continuous = false;
+  // Blocks since the last overflow.
+  size_t since = 0;
+  for (size_t read = 0; since < count or result.overflows < overflows;
+       read++) {
+    if (std::chrono::steady_clock::now() - began > deadline) {
+      std::printf("  not done in %lld s\n",
+                  static_cast<long long>(deadline.count()));
+      result.errors++;
+      break;
+    }
+
+    int flags = 0;
+    long long timeNs = 0;
+    const long timeoutUs = read % 2 == 0 ? 0 : 1000000;
+    const int ret = device.readStream(stream, buffs.data(), mtu, flags,
+                                      timeNs, timeoutUs);
+    if (ret == SOAPY_SDR_TIMEOUT) {
+      result.partial++;
+      continue;
+    }
+    if (ret == SOAPY_SDR_OVERFLOW) {
+      result.overflows++;
+      continuous = false;
+      since = 0;
+      continue;
+    }
+    if (ret <= 0) {
+      result.errors++;
+      if (result.errors > 10) {
+        break;
+      }
+      continue;
+    }
+
+    result.blocks++;
+    since++;
+    // Half a sample either way is rounding.
+    if (continuous and
+        static_cast<double>(std::llabs(timeNs - nextNs)) * rate >= 0.5e9) {
+      result.gaps++;
+    }
+    nextNs = timeNs + SoapySDR::ticksToTimeNs(ret, rate);
+    continuous = true;
+
+    const auto samples = static_cast<size_t>(ret);
+    for (size_t i = 1; i < channels; i++) {
+      for (size_t k = 0; k < samples; k++) {
+        if (buffers[i][k] != buffers[0][k]) {
+          result.mismatched++;
+          break;
+        }
+      }
+    }
+  }
+  device.deactivateStream(stream);
+  device.closeStream(stream);
+
+  std::printf("%zu blocks, %zu timeouts, %zu overflows, %zu mismatched, "
+              "%zu gaps, %zu errors\n",
+              result.blocks, result.partial, result.overflows,
+              result.mismatched, result.gaps, result.errors);
+  std::printf("  alignment %s\n", device.readSetting("alignment").c_str());
+  return result;
+}
+
+} // namespace
+
+int main() {
+  MockConfig config;
+  config.devices = channels;
+  config.delay = delay;
+
+  std::printf("aligned, %zu samples apart\n", delay);
+  const auto aligned = run(config, blocks, 0);
+  bool ok = aligned.errors == 0 and aligned.mismatched == 0 and
+            aligned.gaps == 0 and aligned.overflows == 0 and
+            aligned.partial > 0;
+
+  // A transfer lost about every two seconds, time enough to align.
+  std::printf("receiver 1 losing transfers\n");
+  config.dropDevice = 1;
+  config.dropEvery = 400;
+  const auto dropping = run(config, blocks, 1);
+  ok = ok and dropping.errors == 0 and dropping.mismatched == 0 and
+       dropping.gaps == 0 and dropping.overflows > 0;
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,197 @@
+// Copyright 2024 SM6WJM
+
+// Activation latency with and without soft pause, see the soft_pause
+// device arg, and with the prewarm stream arg. A simulated device that
+// takes a while to start is activated, read until it returns samples,
+// deactivated and left paused, over and over. Prewarmed streams are set
+// up anew every time and left running a while before activation.
+// Reports how long activateStream took and the time from it to the
+// first samples. Checks that samples received before activation are
+// not returned and that the timestamps of the first two reads are
+// contiguous. Fails on errors, or if soft pause or prewarm do not
+// activate faster than stopping and starting.
+
+#include "MockAirspyHF.hpp"
+#include "SoapyAirspyHF.hpp"
+
+#include <SoapySDR/Formats.hpp>
+#include <SoapySDR/Time.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <complex>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t cycles = 20;
+constexpr auto start_delay = std::chrono::milliseconds(10);
+constexpr auto paused = std::chrono::milliseconds(5);
+// Prewarmed streams are activated this long after set up, a few transfers.
+constexpr auto warm = std::chrono::milliseconds(20);
+
+enum class Mode { Stop, Soft, Prewarm };
+
+const char *name(const Mode mode) {
+  switch (mode) {
+  case Mode::Stop:
+    return "stop/start";
+  case Mode::Soft:
+    return "soft";
+  case Mode::Prewarm:
+    return "prewarm";
+  }
+  return "";
+}
+
+double milliseconds(const Clock::duration duration) {
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+struct Latency {
+  std::vector<double> activate;
+  std::vector<double> firstSample;
+  size_t errors = 0;
+  // Timestamps going backwards over a pause.
+  size_t backwards = 0;
+  // First reads with samples received before activation.
+  size_t stale = 0;
+  // Second reads not following on the first.
+  size_t gaps = 0;
+};
+
+double median(std::vector<double> values) {
+  if (values.empty()) {
+    return 0;
+  }
+  std::sort(values.begin(), values.end());
+  return values[values.size() / 2];
+}
+
+double maximum(const std::vector<double> &values) {
+  return values.empty() ? 0 : *std::max_element(values.begin(), values.end());
+}
+
+Latency run(const Mode mode) {
+  SoapyAirspyHF device(SoapySDR::Kwargs{
+      {"soft_pause", mode == Mode::Soft ? "true" : "false"}});
+  const double rate = device.getSampleRate(SOAPY_SDR_RX, 0);
+  // Timestamps count samples received since open.
+  const auto opened = mock_airspyhf_samples();
+  const SoapySDR::Kwargs args{
+      {"prewarm", mode == Mode::Prewarm ? "true" : "false"}};
+  SoapySDR::Stream *stream = nullptr;
+  if (mode != Mode::Prewarm) {
+    stream = device.setupStream(SOAPY_SDR_RX, SOAPY_SDR_CF32, {0}, args);
+  }
+
+  Latency latency;
+  long long last = 0;
+  for (size_t cycle = 0; cycle < cycles; cycle++) {
+    if (mode == Mode::Prewarm) {
+      stream = device.setupStream(SOAPY_SDR_RX, SOAPY_SDR_CF32, {0}, args);
+      std::this_thread::sleep_for(warm);
+    }
+    const size_t mtu = device.getStreamMTU(stream);
+    std::vector<std::complex<float>> buffer(mtu);
+    void *buffs[] = {buffer.data()};
+
+    // Written to the ring buffer before it's counted.
+    const auto received = mock_airspyhf_samples() - opened;
+    const auto began = Clock::now();
+    if (device.activateStream(stream) != 0) {
+      latency.errors++;
+      continue;
+    }
+    const auto activated = Clock::now();
+
+    int ret = SOAPY_SDR_TIMEOUT;
+    int flags = 0;
+    long long timeNs = 0;
+    while (ret == SOAPY_SDR_TIMEOUT) {
+      ret = device.readStream(stream, buffs, mtu, flags, timeNs, 1000000);
+    }
+    const auto read = Clock::now();
+    if (ret <= 0) {
+      latency.errors++;
+    } else {
+      if (cycle > 0 and timeNs <= last) {
+        latency.backwards++;
+      }
+      if (SoapySDR::timeNsToTicks(timeNs, rate) <
+          static_cast<long long>(received)) {
+        latency.stale++;
+      }
+
+      // Half a sample either way is rounding.
+      const long long nextNs = timeNs + SoapySDR::ticksToTimeNs(ret, rate);
+      int more = SOAPY_SDR_TIMEOUT;
+      while (more == SOAPY_SDR_TIMEOUT) {
+        more = device.readStream(stream, buffs, mtu, flags, timeNs, 1000000);
+      }
+      if (more <= 0) {
+        latency.errors++;
+      } else if (static_cast<double>(std::llabs(timeNs - nextNs)) * rate >=
+                 0.5e9) {
+        latency.gaps++;
+      }
+    }
+    last = timeNs;
+
+    // The first activation starts the device, unless prewarmed.
+    if (cycle > 0 or mode == Mode::Prewarm) {
+      latency.activate.push_back(milliseconds(activated - began));
+      latency.firstSample.push_back(milliseconds(read - activated));
+    }
+
+    device.deactivateStream(stream);
+    if (mode == Mode::Prewarm) {
+      device.closeStream(stream);
+    }
+    std::this_thread::sleep_for(paused);
+  }
+  if (mode != Mode::Prewarm) {
+    device.closeStream(stream);
+  }
+
+  std::printf("%-10s %9.3f %9.3f %9.3f %9.3f %7zu %10zu %6zu %5zu\n",
+              name(mode), median(latency.activate), maximum(latency.activate),
+              median(latency.firstSample), maximum(latency.firstSample),
+              latency.errors, latency.backwards, latency.stale,
+              latency.gaps);
+  return latency;
+}
+
+} // namespace
+
+int main() {
+  MockConfig config;
+  config.startDelay = start_delay;
+  mock_airspyhf_configure(config);
+
+  std::printf("%zu cycles, start %lld ms, paused %lld ms\n", cycles,
+              static_cast<long long>(start_delay.count()),
+              static_cast<long long>(paused.count()));
+  std::printf("%-10s %9s %9s %9s %9s %7s %10s %6s %5s\n", "pause",
+              "activate", "max", "first", "max", "errors", "backwards",
+              "stale", "gaps");
+  const auto stopping = run(Mode::Stop);
+  const auto soft = run(Mode::Soft);
+  const auto prewarm = run(Mode::Prewarm);
+
+  bool ok = true;
+  for (const auto *latency : {&stopping, &soft, &prewarm}) {
+    ok = ok and latency->errors == 0 and latency->stale == 0 and
+         latency->gaps == 0;
+  }
+  return ok and soft.backwards == 0 and prewarm.backwards == 0 and
+                 median(soft.activate) < median(stopping.activate) and
+                 median(prewarm.activate) < median(stopping.activate)
+             ? 0
+             : 1;
+}
@@ -0,0 +1,179 @@
+// Copyright 2024 SM6WJM
+
+// Sixteen simulated devices read by coroutines on one thread, see
+// AsyncRead.hpp. Reports throughput and the CPU time of the thread, and
+// checks that deactivation and closing fail waiting reads.
+
+#include "AsyncRead.hpp"
+#include "MockAirspyHF.hpp"
+#include "SoapyAirspyHF.hpp"
+
+#include <SoapySDR/Formats.hpp>
+
+#include <complex>
+#include <coroutine>
+#include <cstdio>
+#include <ctime>
+#include <exception>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+#include <sys/eventfd.h>
+
+namespace {
+
+constexpr size_t devices = 16;
+constexpr double seconds = 1.0;
+constexpr size_t block = 4096;
+
+// Fire and forget coroutine.
+struct Task {
+  struct promise_type {
+    Task get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+struct Receiver {
+  std::unique_ptr<SoapyAirspyHF> device;
+  SoapySDR::Stream *stream = nullptr;
+  int fd = -1;
+};
+
+struct Stats {
+  size_t samples = 0;
+  size_t overflows = 0;
+  size_t errors = 0;
+  size_t done = 0;
+};
+
+double threadCpuSeconds() {
+  timespec now{};
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return static_cast<double>(now.tv_sec) +
+         static_cast<double>(now.tv_nsec) * 1e-9;
+}
+
+Task receive(AsyncLoop &loop, Receiver &rx, const size_t samples,
+             Stats &stats) {
+  std::vector<std::complex<float>> buffer(block);
+  void *buffs[] = {buffer.data()};
+
+  size_t received = 0;
+  while (received < samples) {
+    const auto result = co_await async_read(loop, rx.device.get(), rx.stream,
+                                            rx.fd, buffs, block, 1000000);
+    if (result.ret == SOAPY_SDR_OVERFLOW) {
+      stats.overflows++;
+    } else if (result.ret < 0) {
+      stats.errors++;
+      break;
+    } else {
+      received += static_cast<size_t>(result.ret);
+    }
+  }
+  stats.samples += received;
+  stats.done++;
+}
+
+// A read waiting when the stream goes away fails with STREAM_ERROR.
+bool failsWaiting(AsyncLoop &loop, Receiver &rx, const bool close) {
+  std::vector<std::complex<float>> buffer(block);
+  void *buffs[] = {buffer.data()};
+
+  // Drain, so that the next read waits.
+  int flags = 0;
+  long long timeNs = 0;
+  while (rx.device->readStream(rx.stream, buffs, block, flags, timeNs, 0) >
+         0) {
+  }
+
+  int ret = 0;
+  loop.read(rx.device.get(), rx.stream, rx.fd, buffs, block, 10000000,
+            [&](const AsyncResult &result) { ret = result.ret; });
+  if (close) {
+    rx.device->closeStream(rx.stream);
+    rx.stream = nullptr;
+  } else {
+    rx.device->deactivateStream(rx.stream);
+  }
+  while (loop.pending() > 0) {
+    loop.run_once(1000);
+  }
+  return ret == SOAPY_SDR_STREAM_ERROR;
+}
+
+} // namespace
+
+int main() {
+  MockConfig config;
+  config.devices = devices;
+  mock_airspyhf_configure(config);
+
+  std::vector<Receiver> receivers(devices);
+  for (size_t i = 0; i < devices; i++) {
+    auto &rx = receivers[i];
+    std::stringstream serial;
+    serial << std::hex << mock_airspyhf_serial(i);
+    rx.device = std::make_unique<SoapyAirspyHF>(
+        SoapySDR::Kwargs{{"serial", serial.str()}});
+    rx.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    rx.stream =
+        rx.device->setupStream(SOAPY_SDR_RX, SOAPY_SDR_CF32, {0},
+                               {{"ready_fd", std::to_string(rx.fd)}});
+  }
+  const double rate =
+      receivers.front().device->getSampleRate(SOAPY_SDR_RX, 0);
+  const auto samples = static_cast<size_t>(rate * seconds);
+
+  for (auto &rx : receivers) {
+    rx.device->activateStream(rx.stream);
+  }
+
+  AsyncLoop loop;
+  Stats stats;
+  const auto began = std::chrono::steady_clock::now();
+  const double cpuBegan = threadCpuSeconds();
+  for (auto &rx : receivers) {
+    receive(loop, rx, samples, stats);
+  }
+  size_t wakeups = 0;
+  while (loop.pending() > 0) {
+    loop.run_once();
+    wakeups++;
+  }
+  const double cpu = threadCpuSeconds() - cpuBegan;
+  const double wall =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - began)
+          .count();
+
+  std::printf("%zu devices at %.0f Hz on one thread\n", devices, rate);
+  std::printf("  %zu samples in %.3f s, %.2f Msps\n", stats.samples, wall,
+              static_cast<double>(stats.samples) / wall / 1e6);
+  std::printf("  thread cpu %.3f s (%.1f%%), %zu wakeups\n", cpu,
+              100 * cpu / wall, wakeups);
+  std::printf("  %zu overflows, %zu errors\n", stats.overflows, stats.errors);
+
+  bool ok = stats.done == devices and stats.errors == 0 and
+            stats.samples >= devices * samples;
+
+  const bool deactivated = failsWaiting(loop, receivers[0], false);
+  const bool closed = failsWaiting(loop, receivers[1], true);
+  std::printf("  wake on deactivate %s, on close %s\n",
+              deactivated ? "ok" : "FAILED", closed ? "ok" : "FAILED");
+  ok = ok and deactivated and closed;
+
+  for (auto &rx : receivers) {
+    if (rx.stream != nullptr) {
+      rx.device->closeStream(rx.stream);
+    }
+    rx.device.reset();
+    close(rx.fd);
+  }
+
+  return ok ? 0 : 1;
+}
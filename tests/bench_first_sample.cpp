@@ -0,0 +1,143 @@
+// Copyright 2024 SM6WJM
+
+// Time to first sample of twenty simulated devices, each taking as long
+// to open and start as a real one might. Every device is opened, set up,
+// activated and read until it returns samples, first one after another,
+// then all at once on a thread each. Fails on errors, or if the
+// concurrent startup is not faster than the serial one.
+
+#include "MockAirspyHF.hpp"
+#include "SoapyAirspyHF.hpp"
+
+#include <SoapySDR/Formats.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <complex>
+#include <cstdio>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t devices = 20;
+constexpr auto open_delay = std::chrono::milliseconds(50);
+constexpr auto start_delay = std::chrono::milliseconds(10);
+
+double milliseconds(const Clock::duration duration) {
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+struct Receiver {
+  std::unique_ptr<SoapyAirspyHF> device;
+  SoapySDR::Stream *stream = nullptr;
+  // From the start of the run to the first samples read, ms.
+  double firstSample = 0;
+  std::string startup;
+};
+
+// Opens device i and reads until it has samples. False on errors.
+bool start(Receiver &rx, const size_t i, const Clock::time_point began) {
+  try {
+    std::stringstream serial;
+    serial << std::hex << mock_airspyhf_serial(i);
+    rx.device = std::make_unique<SoapyAirspyHF>(
+        SoapySDR::Kwargs{{"serial", serial.str()}});
+    rx.stream = rx.device->setupStream(SOAPY_SDR_RX, SOAPY_SDR_CF32, {0});
+    if (rx.device->activateStream(rx.stream) != 0) {
+      return false;
+    }
+
+    const size_t mtu = rx.device->getStreamMTU(rx.stream);
+    std::vector<std::complex<float>> buffer(mtu);
+    void *buffs[] = {buffer.data()};
+    int ret = SOAPY_SDR_TIMEOUT;
+    while (ret == SOAPY_SDR_TIMEOUT) {
+      int flags = 0;
+      long long timeNs = 0;
+      ret = rx.device->readStream(rx.stream, buffs, mtu, flags, timeNs,
+                                  1000000);
+    }
+    rx.firstSample = milliseconds(Clock::now() - began);
+    rx.startup = rx.device->readSetting("startup");
+    return ret > 0;
+  } catch (const std::exception &e) {
+    std::printf("device %zu: %s\n", i, e.what());
+    return false;
+  }
+}
+
+void stop(Receiver &rx) {
+  if (rx.stream != nullptr) {
+    rx.device->deactivateStream(rx.stream);
+    rx.device->closeStream(rx.stream);
+    rx.stream = nullptr;
+  }
+  rx.device.reset();
+}
+
+// Starts every device, concurrently or not. Returns the time until the
+// last one had samples in ms, or a negative value on errors.
+double run(const bool concurrent) {
+  std::vector<Receiver> receivers(devices);
+  std::atomic<size_t> failed{0};
+  const auto began = Clock::now();
+  if (concurrent) {
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < devices; i++) {
+      threads.emplace_back([&, i] {
+        if (not start(receivers[i], i, began)) {
+          failed++;
+        }
+      });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+  } else {
+    for (size_t i = 0; i < devices; i++) {
+      if (not start(receivers[i], i, began)) {
+        failed++;
+      }
+    }
+  }
+
+  double last = 0;
+  for (const auto &rx : receivers) {
+    last = std::max(last, rx.firstSample);
+  }
+  std::printf("%-10s %8.1f ms to the last first sample, %zu failed\n",
+              concurrent ? "concurrent" : "serial", last, failed.load());
+  std::printf("  device 0 startup: %s\n", receivers[0].startup.c_str());
+
+  for (auto &rx : receivers) {
+    stop(rx);
+  }
+  return failed == 0 ? last : -1;
+}
+
+} // namespace
+
+int main() {
+  MockConfig config;
+  config.devices = devices;
+  config.openDelay = open_delay;
+  config.startDelay = start_delay;
+  mock_airspyhf_configure(config);
+
+  std::printf("%zu devices, open %lld ms, start %lld ms\n", devices,
+              static_cast<long long>(open_delay.count()),
+              static_cast<long long>(start_delay.count()));
+  const double serial = run(false);
+  const double concurrent = run(true);
+  if (serial > 0 and concurrent > 0) {
+    std::printf("speedup %.1fx\n", serial / concurrent);
+  }
+
+  return serial > 0 and concurrent > 0 and concurrent < serial ? 0 : 1;
+}
@@ -0,0 +1,165 @@
+// Copyright 2024 SM6WJM
+
+// How the driver scales with the number of devices. For each count,
+// enumerates the simulated devices, opens and streams them concurrently
+// with a reader thread each, as fast as they are read, then tears them
+// down concurrently. Reports the times taken, the aggregate throughput
+// and the process CPU time per device and per sample, the simulated
+// producers included.
+
+#include "DeviceList.hpp"
+#include "MockAirspyHF.hpp"
+#include "SoapyAirspyHF.hpp"
+
+#include <SoapySDR/Formats.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <complex>
+#include <cstdio>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t counts[] = {1, 4, 16, 64};
+constexpr auto streaming = std::chrono::milliseconds(500);
+// Listing opens each device.
+constexpr auto open_delay = std::chrono::microseconds(500);
+
+double seconds(const Clock::duration duration) {
+  return std::chrono::duration<double>(duration).count();
+}
+
+double processCpuSeconds() {
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  const auto cpu = [](const timeval &time) {
+    return static_cast<double>(time.tv_sec) +
+           static_cast<double>(time.tv_usec) * 1e-6;
+  };
+  return cpu(usage.ru_utime) + cpu(usage.ru_stime);
+}
+
+// Run f(i) for i < n on a thread each.
+template <typename F> void concurrently(const size_t n, F f) {
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < n; i++) {
+    threads.emplace_back(f, i);
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+struct Receiver {
+  std::unique_ptr<SoapyAirspyHF> device;
+  SoapySDR::Stream *stream = nullptr;
+  size_t samples = 0;
+  size_t errors = 0;
+  double teardown = 0;
+};
+
+} // namespace
+
+int main() {
+  bool ok = true;
+
+  std::printf("%8s %9s %9s %9s %9s %9s %11s %10s\n", "devices", "list ms",
+              "cached ms", "open ms", "close ms", "Msps", "cpu ms/dev",
+              "ns/sample");
+
+  for (const size_t n : counts) {
+    MockConfig config;
+    config.devices = n;
+    config.openDelay = open_delay;
+    config.realtime = false;
+    mock_airspyhf_configure(config);
+
+    // Enumeration, listing and from the cache.
+    DeviceList::instance().invalidate();
+    auto began = Clock::now();
+    const auto serials = DeviceList::instance().serials();
+    const double listed = seconds(Clock::now() - began);
+    began = Clock::now();
+    DeviceList::instance().serials();
+    const double cached = seconds(Clock::now() - began);
+    if (serials.size() != n) {
+      std::printf("listed %zu of %zu devices\n", serials.size(), n);
+      ok = false;
+      continue;
+    }
+
+    std::vector<Receiver> receivers(n);
+    began = Clock::now();
+    concurrently(n, [&](const size_t i) {
+      auto &rx = receivers[i];
+      std::stringstream serial;
+      serial << std::hex << serials[i];
+      rx.device = std::make_unique<SoapyAirspyHF>(
+          SoapySDR::Kwargs{{"serial", serial.str()}});
+      rx.stream = rx.device->setupStream(SOAPY_SDR_RX, SOAPY_SDR_CS16, {0});
+    });
+    const double opened = seconds(Clock::now() - began);
+
+    // Stream and tear down, each device on its own thread.
+    const double cpuBegan = processCpuSeconds();
+    began = Clock::now();
+    std::atomic<bool> running{true};
+    std::thread timer([&] {
+      std::this_thread::sleep_for(streaming);
+      running = false;
+    });
+    concurrently(n, [&](const size_t i) {
+      auto &rx = receivers[i];
+      const size_t mtu = rx.device->getStreamMTU(rx.stream);
+      std::vector<std::complex<int16_t>> buffer(mtu);
+      void *buffs[] = {buffer.data()};
+
+      rx.device->activateStream(rx.stream);
+      while (running) {
+        int flags = 0;
+        long long timeNs = 0;
+        const int ret = rx.device->readStream(rx.stream, buffs, mtu, flags,
+                                              timeNs, 100000);
+        if (ret > 0) {
+          rx.samples += static_cast<size_t>(ret);
+        } else if (ret != SOAPY_SDR_TIMEOUT) {
+          rx.errors++;
+        }
+      }
+      const auto stopping = Clock::now();
+      rx.device->deactivateStream(rx.stream);
+      rx.device->closeStream(rx.stream);
+      rx.device.reset();
+      rx.teardown = seconds(Clock::now() - stopping);
+    });
+    const double wall = seconds(Clock::now() - began);
+    const double cpu = processCpuSeconds() - cpuBegan;
+    timer.join();
+
+    size_t samples = 0;
+    double teardown = 0;
+    for (const auto &rx : receivers) {
+      samples += rx.samples;
+      teardown = std::max(teardown, rx.teardown);
+      if (rx.samples == 0 or rx.errors > 0) {
+        ok = false;
+      }
+    }
+    const auto total = static_cast<double>(samples);
+    std::printf("%8zu %9.2f %9.3f %9.2f %9.2f %9.2f %11.2f %10.2f\n", n,
+                listed * 1e3, cached * 1e3, opened * 1e3, teardown * 1e3,
+                total / wall / 1e6, cpu / static_cast<double>(n) * 1e3,
+                total > 0 ? cpu / total * 1e9 : 0.0);
+  }
+
+  return ok ? 0 : 1;
+}
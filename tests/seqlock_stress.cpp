@@ -0,0 +1,111 @@
+// Copyright 2024 SM6WJM
+
+// DeviceState snapshots under ThreadSanitizer. Writers serialised by a
+// mutex change every field at once, as updateState does, while readers
+// load snapshots as the getters and the rx callback do. A torn or stale
+// snapshot fails the test, TSAN fails it on a data race.
+
+#include "DeviceState.hpp"
+#include "SeqLock.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr size_t writers = 2;
+constexpr size_t readers = 4;
+constexpr uint32_t writes = 20000;
+
+// Every field from one generation k.
+DeviceState generation(const uint32_t k) {
+  DeviceState state;
+  state.sampleRate = k;
+  state.centerFrequency = 3 * k;
+  state.enableDSP = k % 2 == 0;
+  state.agcEnabled = k % 3 == 0;
+  state.lnaGain = k;
+  state.hfAttenuation = -static_cast<double>(k);
+  state.frequencyCorrection = 2.0 * k;
+  state.iqBalance = {static_cast<double>(k), -static_cast<double>(k)};
+  state.calibrationGainDb = 0.5 * k;
+  state.calibrationIqPoint = 0.25 * k;
+  state.calibrationPpb = 4.0 * k;
+  return state;
+}
+
+bool consistent(const DeviceState &state) {
+  const auto expected = generation(state.sampleRate);
+  return state.centerFrequency == expected.centerFrequency and
+         state.enableDSP == expected.enableDSP and
+         state.agcEnabled == expected.agcEnabled and
+         state.lnaGain == expected.lnaGain and
+         state.hfAttenuation == expected.hfAttenuation and
+         state.frequencyCorrection == expected.frequencyCorrection and
+         state.iqBalance == expected.iqBalance and
+         state.calibrationGainDb == expected.calibrationGainDb and
+         state.calibrationIqPoint == expected.calibrationIqPoint and
+         state.calibrationPpb == expected.calibrationPpb;
+}
+
+} // namespace
+
+int main() {
+  SeqLock<DeviceState> state(generation(0));
+  std::mutex stateLock;
+  std::atomic<bool> writing{true};
+  std::atomic<size_t> torn{0};
+  std::atomic<size_t> stale{0};
+  std::atomic<size_t> reads{0};
+
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < readers; i++) {
+    threads.emplace_back([&] {
+      uint32_t last = 0;
+      size_t count = 0;
+      do {
+        const auto snapshot = state.load();
+        if (not consistent(snapshot)) {
+          torn++;
+        }
+        // Generations only grow
+        if (snapshot.sampleRate < last) {
+          stale++;
+        }
+        last = snapshot.sampleRate;
+        count++;
+      } while (writing.load(std::memory_order_relaxed));
+      reads += count;
+    });
+  }
+
+  std::vector<std::thread> writerThreads;
+  for (size_t i = 0; i < writers; i++) {
+    writerThreads.emplace_back([&] {
+      for (uint32_t n = 0; n < writes; n++) {
+        // As updateState
+        std::unique_lock<std::mutex> lock(stateLock);
+        const auto current = state.load();
+        state.store(generation(current.sampleRate + 1));
+      }
+    });
+  }
+  for (auto &thread : writerThreads) {
+    thread.join();
+  }
+  writing = false;
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  const auto final = state.load();
+  std::printf("%zu reads of %u writes, %zu torn, %zu stale\n", reads.load(),
+              final.sampleRate, torn.load(), stale.load());
+
+  return torn == 0 and stale == 0 and final.sampleRate == writers * writes
+             ? 0
+             : 1;
+}